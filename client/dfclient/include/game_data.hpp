@@ -18,6 +18,8 @@ struct GameData {
     std::string myNickname;
     uint16_t myMobID;
     uint16_t myPlayerID;
+    // lets us rejoin our match after the server moved it to another instance
+    uint64_t sessionToken = 0;
     std::vector<Player> players;
     std::string levelData;
     bool gameInProgress = false;
@@ -15,8 +15,8 @@ namespace nc = ncine;
 
 #include "../../../common/constants.hpp"
 #include "../../../common/deadfish_generated.h"
+#include "../../../common/fov.hpp"
 #include "../../../common/types.hpp"
-#include "fov.hpp"
 #include "game_state.hpp"
 #include "lerp_component.hpp"
 #include "death_report_processor.hpp"
@@ -68,6 +68,7 @@ struct GameplayState
 	void ProcessSimpleServerEvent(const void* simpleServerEvent);
 	void ProcessWorldState(const void* worldState);
 	void ProcessSkillBarUpdate(const void* worldState);
+	void ProcessPing(const void* ping);
 
 private:
 	void OnMessage(const std::string& data);
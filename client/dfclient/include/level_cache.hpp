@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Levels the server already sent us, keyed by their content hash.
+// Native builds keep them in a directory, the wasm build in IndexedDB.
+namespace levelcache {
+
+// calls onDone with the cached level or with an empty string on a miss,
+// synchronously on native and from the browser event loop on wasm
+void Load(uint64_t hash, std::function<void(std::string)> onDone);
+void Store(uint64_t hash, const std::string& data);
+
+}
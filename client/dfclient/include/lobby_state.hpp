@@ -21,16 +21,28 @@ struct LobbyState
 	void OnMouseButtonPressed(const ncine::MouseEvent &event) override;
 
 private:
-	StateType OnMessage(const std::string& data);
+	// the announced level being looked up in the level cache
+	struct PendingLevel {
+		uint64_t hash = 0;
+		bool loaded = false;
+		std::string data;
+	};
+
+	StateType OnMessage(std::string& data);
 
 	void RedrawPlayers();
 
 	void SendPlayerReady();
+	void SendLevelCacheStatus(uint64_t hash, bool hit);
+	void SendPong(uint64_t serverTime);
 
 	std::vector<std::unique_ptr<ncine::SceneNode>> sceneNodes;
 	std::vector<std::unique_ptr<ncine::TextNode>> textNodes;
 	std::unique_ptr<ncine::TextNode> readyButton;
 	bool ready = false;
+	std::shared_ptr<PendingLevel> pendingLevel;
+	// from the LevelAnnounce on, in-match messages can arrive before the level is in
+	bool levelAnnounced = false;
 
 	TextCreator textCreator;
 
@@ -21,6 +21,8 @@ struct WebSocket {
 
 struct WebSocketManager {
 	Messages GetMessages();
+	// puts messages taken with GetMessages back in front of the queue
+	void Requeue(std::vector<std::string> messages);
 
 	std::unique_ptr<WebSocket> _ws;
 };
@@ -120,13 +120,25 @@ void GameplayState::LoadLevel() {
 	}
 
 	// initialize tile layer
-	if (level->tilelayer() && level->tilelayer()->tiledata()) {
+	if (level->tilelayer() && (level->tilelayer()->tiledata() || level->tilelayer()->tiledataRle())) {
 		auto width = level->tilelayer()->width();
 		auto height = level->tilelayer()->height();
 		auto tilewidth = level->tilelayer()->tilesize()->x();
 		auto tileheight = level->tilelayer()->tilesize()->y();
-		
-		auto currentTile = level->tilelayer()->tiledata()->begin();
+
+		std::vector<uint16_t> tiledata;
+		if (level->tilelayer()->tiledataRle()) {
+			// (run length, gid) pairs
+			auto rle = level->tilelayer()->tiledataRle();
+			tiledata.reserve(width * height);
+			for (size_t i = 0; i + 1 < rle->size(); i += 2)
+				tiledata.insert(tiledata.end(), rle->Get(i), rle->Get(i + 1));
+		} else {
+			tiledata.assign(level->tilelayer()->tiledata()->begin(), level->tilelayer()->tiledata()->end());
+		}
+		tiledata.resize(width * height);
+
+		auto currentTile = tiledata.begin();
 		for (int i=0; i<height; ++i) {	// rows
 			for (int j=0; j<width; ++j) {	// columns
 				auto spritename = spritemap[*currentTile++];
@@ -196,7 +208,7 @@ void GameplayState::LoadLevel() {
 				c.reserve(mask->polyverts()->size());
 				for (auto v : *mask->polyverts()) {
 					auto vv = ncine::Vector4f(v->x(), v->y(), 0.f, 1.f) * transform;
-					c.push_back(ncine::Vector2f(vv.x, vv.y));
+					c.push_back(fov::vec2(vv.x, vv.y));
 				}
 				shadowMesh.addChain(c);
 			}
@@ -389,6 +401,16 @@ void GameplayState::ProcessSkillBarUpdate(const void* ev) {
 	}
 }
 
+void GameplayState::ProcessPing(const void* ev) {
+	// answer right away so that the server measures the round trip including our frame time
+	auto ping = (const FlatBuffGenerated::Ping*) ev;
+	flatbuffers::FlatBufferBuilder builder;
+	auto pong = FlatBuffGenerated::CreatePong(builder, ping->serverTime());
+	auto message = FlatBuffGenerated::CreateClientMessage(builder, FlatBuffGenerated::ClientMessageUnion_Pong, pong.Union());
+	builder.Finish(message);
+	SendData(builder);
+}
+
 void GameplayState::OnMessage(const std::string& data) {
 	lastMessageReceivedTime = ncine::TimeStamp::now();
 
@@ -429,6 +451,8 @@ GameplayState::GameplayState(Resources& r) : _resources(r), _deathReportProcesso
 		&GameplayState::ProcessWorldState;
 	messageHandlers[FlatBuffGenerated::ServerMessageUnion_SkillBarUpdate] =
 		&GameplayState::ProcessSkillBarUpdate;
+	messageHandlers[FlatBuffGenerated::ServerMessageUnion_Ping] =
+		&GameplayState::ProcessPing;
 }
 
 GameplayState::~GameplayState() {
@@ -684,7 +708,7 @@ void GameplayState::updateShadows() {
 	const auto camPos = this->cameraNode->absPosition();
 	auto origin = mySprite->position();
 
-	const auto outline = shadowMesh.calculateOutline(ncine::Vector2f(origin.x, -origin.y) * PIXELS2METERS);
+	const auto outline = shadowMesh.calculateOutline(fov::vec2(origin.x, -origin.y) * PIXELS2METERS);
 	std::vector<ncine::MeshSprite::Vertex> strip;
 	strip.resize(outline.size() * 6);
 
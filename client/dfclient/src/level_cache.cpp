@@ -0,0 +1,110 @@
+#include "level_cache.hpp"
+
+#include <cstdio>
+#include <iostream>
+
+#include "../../../common/hash.hpp"
+
+namespace levelcache {
+
+static std::string Key(uint64_t hash) {
+	char key[32];
+	snprintf(key, sizeof(key), "level_%016llx", (unsigned long long) hash);
+	return key;
+}
+
+}
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+
+namespace levelcache {
+
+static const char* IDB_NAME = "deadfish";
+
+struct PendingLoad {
+	uint64_t hash;
+	std::function<void(std::string)> onDone;
+};
+
+static void OnLoad(void* arg, void* buf, int size) {
+	auto pending = (PendingLoad*) arg;
+	std::string data((const char*) buf, size);
+	// a half-written or stale entry counts as a miss
+	if (contentHash(data.data(), data.size()) != pending->hash)
+		data.clear();
+	pending->onDone(std::move(data));
+	delete pending;
+}
+
+static void OnLoadError(void* arg) {
+	auto pending = (PendingLoad*) arg;
+	pending->onDone("");
+	delete pending;
+}
+
+static void OnStoreError(void*) {
+	std::cout << "failed to store the level in IndexedDB\n";
+}
+
+void Load(uint64_t hash, std::function<void(std::string)> onDone) {
+	auto pending = new PendingLoad{hash, std::move(onDone)};
+	emscripten_idb_async_load(IDB_NAME, Key(hash).c_str(), pending, &OnLoad, &OnLoadError);
+}
+
+void Store(uint64_t hash, const std::string& data) {
+	// the data is copied out of the wasm heap before this returns
+	emscripten_idb_async_store(IDB_NAME, Key(hash).c_str(), (void*) data.data(), data.size(),
+		nullptr, nullptr, &OnStoreError);
+}
+
+}
+
+#else // __EMSCRIPTEN__
+
+#include <filesystem>
+#include <fstream>
+
+namespace levelcache {
+
+static const char* CACHE_DIR = "levelcache";
+
+static std::string Path(uint64_t hash) {
+	return std::string(CACHE_DIR) + "/" + Key(hash) + ".bin";
+}
+
+void Load(uint64_t hash, std::function<void(std::string)> onDone) {
+	std::ifstream in(Path(hash), std::ios::in | std::ios::binary);
+	if (!in.is_open()) {
+		onDone("");
+		return;
+	}
+	std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	// a half-written or stale entry counts as a miss
+	if (contentHash(data.data(), data.size()) != hash)
+		data.clear();
+	onDone(std::move(data));
+}
+
+void Store(uint64_t hash, const std::string& data) {
+	std::error_code ec;
+	std::filesystem::create_directories(CACHE_DIR, ec);
+	// write to a temporary file first so a crash never leaves a truncated entry behind
+	auto path = Path(hash);
+	auto tmpPath = path + ".tmp";
+	{
+		std::ofstream out(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		out.write(data.data(), data.size());
+		if (!out) {
+			std::cout << "failed to write the level cache " << tmpPath << "\n";
+			return;
+		}
+	}
+	std::filesystem::rename(tmpPath, path, ec);
+	if (ec)
+		std::cout << "failed to store the level cache " << path << ": " << ec.message() << "\n";
+}
+
+}
+
+#endif // __EMSCRIPTEN__
@@ -1,16 +1,53 @@
 #include <iostream>
 #include <functional>
+#include <iterator>
+
+#include <zlib.h>
 
 #include <ncine/Application.h>
 
 #include "lobby_state.hpp"
 #include "game_data.hpp"
 #include "../../../common/deadfish_generated.h"
+#include "../../../common/hash.hpp"
 #include "fb_util.hpp"
+#include "level_cache.hpp"
 #include "resources.hpp"
 #include "util.hpp"
 
-StateType LobbyState::OnMessage(const std::string& data) {
+void LobbyState::SendLevelCacheStatus(uint64_t hash, bool hit) {
+	flatbuffers::FlatBufferBuilder builder;
+	auto status = FlatBuffGenerated::CreateLevelCacheStatus(builder, hash, hit);
+	auto message = FlatBuffGenerated::CreateClientMessage(builder, FlatBuffGenerated::ClientMessageUnion_LevelCacheStatus, status.Union());
+	builder.Finish(message);
+
+	SendData(builder);
+}
+
+void LobbyState::SendPong(uint64_t serverTime) {
+	flatbuffers::FlatBufferBuilder builder;
+	auto pong = FlatBuffGenerated::CreatePong(builder, serverTime);
+	auto message = FlatBuffGenerated::CreateClientMessage(builder, FlatBuffGenerated::ClientMessageUnion_Pong, pong.Union());
+	builder.Finish(message);
+
+	SendData(builder);
+}
+
+// the match is already running while the announced level is looked up or downloaded
+static bool isMatchMessage(std::string& data) {
+	switch (flatbuffers::GetRoot<FlatBuffGenerated::ServerMessage>(data.data())->event_type()) {
+	case FlatBuffGenerated::ServerMessageUnion_WorldState:
+	case FlatBuffGenerated::ServerMessageUnion_HighscoreUpdate:
+	case FlatBuffGenerated::ServerMessageUnion_SkillBarUpdate:
+	case FlatBuffGenerated::ServerMessageUnion_DeathReport:
+	case FlatBuffGenerated::ServerMessageUnion_SimpleServerEvent:
+		return true;
+	default:
+		return false;
+	}
+}
+
+StateType LobbyState::OnMessage(std::string& data) {
 	std::cout << "lobby received data\n";
 	auto event = FBUtilGetServerEvent(data, SimpleServerEvent);
 	if (event) {
@@ -20,11 +57,47 @@ StateType LobbyState::OnMessage(const std::string& data) {
 			return StateType::Menu;
 		}
 	}
+	auto announce = FBUtilGetServerEvent(data, LevelAnnounce);
+	if (announce) {
+		auto pending = std::make_shared<PendingLevel>();
+		pending->hash = announce->hash();
+		this->pendingLevel = pending;
+		this->levelAnnounced = true;
+		levelcache::Load(pending->hash, [pending](std::string cached) {
+			pending->data = std::move(cached);
+			pending->loaded = true;
+		});
+		return StateType::Lobby;
+	}
 	auto level = FBUtilGetServerEvent(data, Level);
 	if (level) {
-		gameData.levelData = data; // copy it
+		gameData.levelData = std::move(data);
+		levelcache::Store(contentHash(gameData.levelData.data(), gameData.levelData.size()), gameData.levelData);
 		return StateType::Gameplay;
 	}
+	auto compressedLevel = FBUtilGetServerEvent(data, CompressedLevel);
+	if (compressedLevel) {
+		std::string levelData(compressedLevel->size(), '\0');
+		uLongf size = levelData.size();
+		if (uncompress((Bytef*) &levelData[0], &size, compressedLevel->data()->data(),
+			compressedLevel->data()->size()) != Z_OK || size != levelData.size()) {
+			std::cout << "failed to decompress the level\n";
+			return StateType::Lobby;
+		}
+		gameData.levelData = std::move(levelData);
+		levelcache::Store(contentHash(gameData.levelData.data(), gameData.levelData.size()), gameData.levelData);
+		return StateType::Gameplay;
+	}
+	auto ping = FBUtilGetServerEvent(data, Ping);
+	if (ping) {
+		// answered here too, the server keeps measuring the round trip while the level loads
+		this->SendPong(ping->serverTime());
+		return StateType::Lobby;
+	}
+	if (this->levelAnnounced && isMatchMessage(data)) {
+		// the gameplay state gets a full WorldState every tick, a missed one does not matter
+		return StateType::Lobby;
+	}
 	auto initMetadata = FBUtilGetServerEvent(data, InitMetadata);
 	if (!initMetadata) {
 		std::cout << "wrong data received\n";
@@ -32,6 +105,7 @@ StateType LobbyState::OnMessage(const std::string& data) {
 	}
 	gameData.myMobID = initMetadata->yourMobID();
 	gameData.myPlayerID = initMetadata->yourPlayerID();
+	gameData.sessionToken = initMetadata->sessionToken();
 	std::cout << "my mob id " << gameData.myMobID << "\n";
 	gameData.players.clear();
 	for (size_t i = 0; i < initMetadata->players()->size(); i++)
@@ -51,7 +125,7 @@ LobbyState::LobbyState(Resources& r) : _resources(r), textCreator(r) {
 	std::cout << "lobby create\n";
 
 	flatbuffers::FlatBufferBuilder builder;
-	auto req = FlatBuffGenerated::CreateJoinRequest(builder, builder.CreateString(gameData.myNickname));
+	auto req = FlatBuffGenerated::CreateJoinRequest(builder, builder.CreateString(gameData.myNickname), gameData.sessionToken);
 	auto message = FlatBuffGenerated::CreateClientMessage(builder, FlatBuffGenerated::ClientMessageUnion_JoinRequest, req.Union());
 	builder.Finish(message);
 
@@ -79,13 +153,30 @@ LobbyState::LobbyState(Resources& r) : _resources(r), textCreator(r) {
 }
 
 StateType LobbyState::Update(Messages m) {
-	for (auto& msg: m.data_msgs) {
-		auto msgState = OnMessage(msg);
+	for (size_t i = 0; i < m.data_msgs.size(); i++) {
+		auto msgState = OnMessage(m.data_msgs[i]);
+		if (msgState == StateType::Gameplay) {
+			// what the server sent after the level is for the gameplay state
+			webSocketManager.Requeue(std::vector<std::string>(
+				std::make_move_iterator(m.data_msgs.begin() + i + 1),
+				std::make_move_iterator(m.data_msgs.end())));
+		}
 		if (msgState != StateType::Lobby) {
 			return msgState;
 		}
 	}
 
+	if (this->pendingLevel && this->pendingLevel->loaded) {
+		auto pending = std::move(this->pendingLevel);
+		bool hit = !pending->data.empty();
+		this->SendLevelCacheStatus(pending->hash, hit);
+		if (hit) {
+			gameData.levelData = std::move(pending->data);
+			return StateType::Gameplay;
+		}
+		// otherwise the server sends the level
+	}
+
 	RedrawPlayers();
 	if (this->ready)
 		this->readyButton->setColor(128, 128, 128, 255);
@@ -1,6 +1,7 @@
 #include "websocket.hpp"
 
 #include <iostream>
+#include <iterator>
 
 WebSocketManager webSocketManager;
 
@@ -22,6 +23,18 @@ Messages WebSocketManager::GetMessages() {
 	return m;
 }
 
+// Runs in game loop thread
+void WebSocketManager::Requeue(std::vector<std::string> messages) {
+	if (!_ws || messages.empty()) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(_ws->mq_mutex);
+	messages.insert(messages.end(), std::make_move_iterator(_ws->messageQueue.begin()),
+		std::make_move_iterator(_ws->messageQueue.end()));
+	_ws->messageQueue.swap(messages);
+}
+
 #ifdef __EMSCRIPTEN__
 #include <emscripten/websocket.h>
 
@@ -7,7 +7,9 @@ const int SECOND = 1000/FRAME_TIME; // 1s
 
 const uint64_t ROUND_LENGTH = 10 * 60 * 20; // 10 minutes
 const int CIVILIAN_TIME = 40;
-const int MAX_CIVILIANS = 100;
+const uint32_t CIVILIAN_SPAWNS_PER_TICK = 2; // the civilians due every CIVILIAN_TIME are spread over ticks
+const int MAX_CIVILIANS = 100; // default of the server's --maxcivilians
+const int MAX_PLAYERS = 6; // lobby size, the server advertises the free seats below it to the matchmaker
 const float INSTA_KILL_DISTANCE = 0.61f;
 const int KILL_REWARD = 5;
 const int CIVILIAN_PENALTY = -1;
@@ -21,6 +23,7 @@ const int REVENGE_REWARD = 2;
 const uint16_t COMEBACK_THRESHOLD = 4;
 const int COMEBACK_REWARD = 2;
 
+const float MOB_RADIUS = 0.3f;
 const float TURN_SPEED = 4.f;
 const float WALK_SPEED = 1.f;
 const float RUN_MODIFIER = 2.f;
@@ -34,6 +37,10 @@ const float TOO_SLOW = 0.4f;
 const int CIV_SLOW_FRAMES = 40;
 const int CIV_RESET_FRAMES = 80;
 const float CHASE_SPEED_BONUS = 1.25f;
+// civilians farther than this from every player leave the physics and walk along the navgraph
+const float CIV_RAILS_RADIUS = 15.f;
+// and come back only when a player is closer than CIV_RAILS_RADIUS - CIV_RAILS_HYSTERESIS
+const float CIV_RAILS_HYSTERESIS = 3.f;
 
 const float TO_DEGREES = (180.f / M_PI);
 const float TO_RADIANS = (M_PI / 180.f);
@@ -1,24 +1,79 @@
-#include <cassert>
+#pragma once
+
+#include <algorithm>
 #include <cmath>
-#include <set>
-#include <queue>
 #include <functional>
+#include <queue>
+#include <set>
+#include <vector>
 
-#include "fov.hpp"
-
+// Field of view against the collision masks of a level. It only knows about points and segments
+// in level meters, the client draws its shadows from the outline and the server tests entities
+// against the visibility polygon the outline bounds.
 namespace fov {
 
-static std::vector<segment> deoverlap(ncine::Vector2f origin, std::vector<segment> segments);
+/// A point or a direction, in level meters.
+struct vec2 {
+	float x = 0.f;
+	float y = 0.f;
+
+	vec2() {}
+	vec2(float x, float y) : x(x), y(y) {}
+
+	vec2 operator+(vec2 other) const { return vec2(x + other.x, y + other.y); }
+	vec2 operator-(vec2 other) const { return vec2(x - other.x, y - other.y); }
+	vec2 operator*(float s) const { return vec2(x * s, y * s); }
+	float sqrLength() const { return x * x + y * y; }
+	float length() const { return std::sqrt(sqrLength()); }
+};
+
+/// A sequence of points which form a light-blocking chain.
+using chain = std::vector<vec2>;
+using segment = std::pair<vec2, vec2>;
+
+struct circle {
+	vec2 pos;
+	float radius;
+};
+
+/// The visibility polygon around `origin`, bounded by the outline the mesh
+/// calculated for the origin and open wherever the outline has a gap.
+///
+/// Every segment of the outline is a part of a real light-blocking segment,
+/// so a point outside the polygon is hidden. Where masks overlap the outline
+/// may miss a segment (see deoverlap), so a point inside is only likely seen.
+struct view {
+	vec2 origin;
+	std::vector<segment> outline;
+
+	/// Whether `point` is inside the polygon, that is, no segment of the outline
+	/// lies between the origin and the point.
+	bool contains(vec2 point) const;
+};
 
-inline static double cross(ncine::Vector2f a, ncine::Vector2f b) {
+/// A mesh describing light-blocking parts of the level.
+class mesh {
+private:
+	std::vector<segment> _segments;
+	std::vector<circle> _circles;
+
+public:
+	void addChain(const chain& c);
+	void addChain(const circle& c);
+	/// With `clampToSegments` the outline never leaves the segments it was
+	/// made of, see deoverlap.
+	std::vector<segment> calculateOutline(vec2 origin, bool clampToSegments = false) const;
+};
+
+inline static double cross(vec2 a, vec2 b) {
 	return a.x * b.y - a.y * b.x;
 }
 
-inline static double dot(ncine::Vector2f a, ncine::Vector2f b) {
+inline static double dot(vec2 a, vec2 b) {
 	return a.x * b.x + a.y * b.y;
 }
 
-static bool isOrientedClockwise(const chain& c) {
+inline static bool isOrientedClockwise(const chain& c) {
 	if (c.empty()) {
 		return true;
 	}
@@ -26,8 +81,8 @@ static bool isOrientedClockwise(const chain& c) {
 	// Calculate the signed area of the polygon bounded by the chain.
 	// Assumption: there are no self-intersections in the chain.
 	float area = 0;
-	ncine::Vector2f prev = c.back();
-	for (ncine::Vector2f curr : c) {
+	vec2 prev = c.back();
+	for (vec2 curr : c) {
 		area += cross(prev, curr);
 		prev = curr;
 	}
@@ -42,14 +97,14 @@ static bool isOrientedClockwise(const chain& c) {
 // Returns the intersection points of the circles. Always returns at most
 // two points.
 // `out` must point to an at-least-two-element array.
-static size_t circleIntersection(const circle& a, const circle& b, ncine::Vector2f* out) {
+inline static size_t circleIntersection(const circle& a, const circle& b, vec2* out) {
 	const auto d = b.pos - a.pos;
 	const auto dist = d.length();
 	if (dist > a.radius + b.radius) {
 		// Circles are disjoint
 		return 0;
 	}
-	if (dist < abs(a.radius - b.radius)) {
+	if (dist < std::abs(a.radius - b.radius)) {
 		// One circle is contained in the other
 		return 0;
 	}
@@ -57,17 +112,17 @@ static size_t circleIntersection(const circle& a, const circle& b, ncine::Vector
 	const float p = ((a.radius * a.radius) - (b.radius * b.radius) + dist * dist)
 			/ (2.f * dist);
 	const auto p2 = a.pos + d * (p / dist);
-	const auto h = sqrtf((a.radius * a.radius) - (p * p));
-	const auto r = ncine::Vector2f(-d.y, d.x) * (h / dist);
+	const auto h = std::sqrt((a.radius * a.radius) - (p * p));
+	const auto r = vec2(-d.y, d.x) * (h / dist);
 	out[0] = p2 + r;
 	out[1] = p2 - r;
 	return 2;
 }
 
-void mesh::addChain(const chain& c) {
+inline void mesh::addChain(const chain& c) {
 	const bool cw = isOrientedClockwise(c);
-	ncine::Vector2f prev = c.back();
-	for (ncine::Vector2f curr : c) {
+	vec2 prev = c.back();
+	for (vec2 curr : c) {
 		if (cw) {
 			_segments.emplace_back(prev, curr);
 		} else {
@@ -77,44 +132,10 @@ void mesh::addChain(const chain& c) {
 	}
 }
 
-void mesh::addChain(const circle& c) {
+inline void mesh::addChain(const circle& c) {
 	_circles.push_back(c);
 }
 
-std::vector<segment> mesh::calculateOutline(ncine::Vector2f origin) const {
-	std::vector<segment> ret;
-
-	for (const auto& seg : _segments) {
-		// Optimization: include the segment in the outline iff it is
-		// front facing towards the origin. Assuming that the segments
-		// originate from simple polygons, the front-facing segments
-		// will always obscure the back-facing segments. This reduces
-		// the number of segments to be processed in the deoverlapping phase,
-		// and does not affect the outcome.
-		if (cross(seg.second - seg.first, origin - seg.first) < 0.f) {
-			ret.push_back(seg);
-		}
-	}
-
-	for (const auto& c : _circles) {
-		// The circle is represented by a line segment between points
-		// formed by intersection of rays tangential to the circle,
-		// with the circle. The resulting shadow outside the area of the
-		// circle will have exactly the same shape as the shadow cast by
-		// a real circle would have.
-		circle intersectionC;
-		intersectionC.pos = (origin + c.pos) * 0.5f;
-		intersectionC.radius = (origin - c.pos).length() * 0.5f;
-
-		ncine::Vector2f pts[2];
-		if (circleIntersection(intersectionC, c, pts) == 2) {
-			ret.emplace_back(pts[0], pts[1]);
-		}
-	}
-
-	return deoverlap(origin, std::move(ret));
-}
-
 struct event {
 	enum class type {
 		removeSegment = 0,
@@ -157,14 +178,14 @@ struct event {
 // If objects do not overlap, returns a negative number. Otherwise returns
 // a number which represents the distance from `origin` to the intersection
 // point divided by the length of `d`.
-float raySegmentTest(ncine::Vector2f origin, ncine::Vector2f d, segment seg, bool treatSegmentAsLine = false) {
+inline float raySegmentTest(vec2 origin, vec2 d, segment seg, bool treatSegmentAsLine = false) {
 	// https://rootllama.wordpress.com/2014/06/20/ray-line-segment-intersection-test-in-2d/
 	const auto v1 = origin - seg.first;
 	const auto v2 = seg.second - seg.first;
-	const auto v3 = ncine::Vector2f(-d.y, d.x);
+	const auto v3 = vec2(-d.y, d.x);
 
 	const auto dp = dot(v2, v3);
-	if (fabs(dp) < 0.001f) {
+	if (std::fabs(dp) < 0.001f) {
 		return -1.0f;
 	}
 
@@ -198,7 +219,13 @@ float raySegmentTest(ncine::Vector2f origin, ncine::Vector2f d, segment seg, boo
 //
 // TODO: Detect crossing segments. Running Bentley-Ottmann algorithm
 // before running the current one should suffice.
-static std::vector<segment> deoverlap(ncine::Vector2f origin, std::vector<segment> segments) {
+//
+// Where the broom order is off because of crossing segments, the ray can
+// meet the line of a segment far beyond its ends. With `clampToSegments`
+// such points are kept on the segment, so every part of the outline lies on
+// a real edge. Shadows drawn from the outline look the same either way
+// except around crossing segments, a visibility test needs the clamp.
+inline std::vector<segment> deoverlap(vec2 origin, std::vector<segment> segments, bool clampToSegments = false) {
 	struct segmentRef { int segmentID; };
 
 	auto segmentCompare = [&] (const segmentRef& a, const segmentRef& b) -> bool {
@@ -254,8 +281,8 @@ static std::vector<segment> deoverlap(ncine::Vector2f origin, std::vector<segmen
 
 	// Push those segments to the queue which are overlapping with a ray
 	// starting from the origin, and going to the right (increasing X)
-	for (int i = 0; i < segments.size(); i++) {
-		const auto addEvt = [&] (ncine::Vector2f pt, event::type typ, int segmentID) {
+	for (int i = 0; i < (int)segments.size(); i++) {
+		const auto addEvt = [&] (vec2 pt, event::type typ, int segmentID) {
 			const auto d = pt - origin;
 			auto a = -atan2(d.y, d.x);
 			if (a < 0.f) {
@@ -280,9 +307,15 @@ static std::vector<segment> deoverlap(ncine::Vector2f origin, std::vector<segmen
 
 	// Calculates the intersection point of a ray from origin going through
 	// the line (segment) `seg`.
-	auto shoot = [&] (ncine::Vector2f through, segment seg) -> ncine::Vector2f {
+	auto shoot = [&] (vec2 through, segment seg) -> vec2 {
 		const auto d = raySegmentTest(origin, (through - origin), seg, true);
-		return origin + (through - origin) * d;
+		const auto pt = origin + (through - origin) * d;
+		if (!clampToSegments) {
+			return pt;
+		}
+		const auto e = seg.second - seg.first;
+		const auto t = std::min(1., std::max(0., dot(pt - seg.first, e) / dot(e, e)));
+		return seg.first + e * t;
 	};
 
 	// prevMin holds the index of the first segment which intersects the ray.
@@ -293,9 +326,9 @@ static std::vector<segment> deoverlap(ncine::Vector2f origin, std::vector<segmen
 	// prevPt holds a point which will be used as a beginning of the next
 	// segment to include in the result list.
 	// It's valid iff prevMin != -1
-	ncine::Vector2f prevPt;
+	vec2 prevPt;
 	if (prevMin != -1) {
-		prevPt = shoot(origin + ncine::Vector2f(1.f, 0.f), segments[prevMin]);
+		prevPt = shoot(origin + vec2(1.f, 0.f), segments[prevMin]);
 	}
 
 	// Process events in the queue
@@ -305,7 +338,7 @@ static std::vector<segment> deoverlap(ncine::Vector2f origin, std::vector<segmen
 
 		// Update the broom according to the event, and get the point
 		// associated with the event
-		ncine::Vector2f pt;
+		vec2 pt;
 		if (evt.typ == event::type::addSegment) {
 			broom.insert(segmentRef { evt.segmentID });
 			pt = segments[evt.segmentID].first;
@@ -368,11 +401,71 @@ static std::vector<segment> deoverlap(ncine::Vector2f origin, std::vector<segmen
 		// fragment of the first visible part.
 		ret.push_back(segment {
 			prevPt,
-			shoot(origin + ncine::Vector2f(1.f, 0.f), segments[prevMin])
+			shoot(origin + vec2(1.f, 0.f), segments[prevMin])
 		});
 	}
 
 	return ret;
 }
 
+inline std::vector<segment> mesh::calculateOutline(vec2 origin, bool clampToSegments) const {
+	std::vector<segment> ret;
+
+	for (const auto& seg : _segments) {
+		// Optimization: include the segment in the outline iff it is
+		// front facing towards the origin. Assuming that the segments
+		// originate from simple polygons, the front-facing segments
+		// will always obscure the back-facing segments. This reduces
+		// the number of segments to be processed in the deoverlapping phase,
+		// and does not affect the outcome.
+		if (cross(seg.second - seg.first, origin - seg.first) < 0.f) {
+			ret.push_back(seg);
+		}
+	}
+
+	for (const auto& c : _circles) {
+		// The circle is represented by a line segment between points
+		// formed by intersection of rays tangential to the circle,
+		// with the circle. The resulting shadow outside the area of the
+		// circle will have exactly the same shape as the shadow cast by
+		// a real circle would have.
+		circle intersectionC;
+		intersectionC.pos = (origin + c.pos) * 0.5f;
+		intersectionC.radius = (origin - c.pos).length() * 0.5f;
+
+		vec2 pts[2];
+		if (circleIntersection(intersectionC, c, pts) == 2) {
+			ret.emplace_back(pts[0], pts[1]);
+		}
+	}
+
+	return deoverlap(origin, std::move(ret), clampToSegments);
+}
+
+/// How far before the point, as a fraction of the way to it, the outline has
+/// to cross to hide the point.
+static const double CONTAINS_EPSILON = 1e-4;
+
+inline bool view::contains(vec2 point) const {
+	const auto d = point - origin;
+	for (const auto& seg : outline) {
+		// The outline segments don't overlap as seen from the origin, so at
+		// most one of them can cross the way to the point.
+		const auto e = seg.second - seg.first;
+		const double denom = cross(d, e);
+		if (denom == 0.) {
+			continue;
+		}
+		const auto w = seg.first - origin;
+		const double t = cross(w, e) / denom;
+		const double s = cross(w, d) / denom;
+		// A point lying on the outline itself, like the edge of a body
+		// touching a wall, counts as inside, rounding must not hide it.
+		if (t >= 0. && t < 1. - CONTAINS_EPSILON && s >= 0. && s <= 1.) {
+			return false;
+		}
+	}
+	return true;
+}
+
 }
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit FNV-1a, it has to give the same result on the server and on every client platform
+// pass the previous result as hash to hash several buffers as one
+inline uint64_t contentHash(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+	const uint8_t* bytes = (const uint8_t*) data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// Layout of a match recording (.dfrec), written by the server with --recorddir:
+//
+//   RecordingHeader
+//   chunk 0: keyframe, frame, frame, ...
+//   chunk 1: keyframe, frame, frame, ...
+//   ...
+//   RecordingIndexEntry[header.indexEntries] at header.indexOffset
+//
+// Every frame is a size-prefixed RecordingFrame flatbuffer starting at an 8 byte aligned offset,
+// so a reader can mmap the file and access the frames in place. To get to a tick look up its chunk
+// in the index, start from the keyframe and apply the frames after it up to the tick.
+// indexOffset is 0 if the server died before the match ended, the frames can still be walked
+// one after another from the end of the header.
+
+const char RECORDING_MAGIC[8] = {'D', 'F', 'R', 'E', 'C', 0, 0, 0};
+const uint32_t RECORDING_VERSION = 1;
+const uint32_t RECORDING_ALIGNMENT = 8;
+
+struct RecordingHeader {
+	char magic[8];
+	uint32_t version;
+	// ticks per second
+	uint32_t tickRate;
+	uint64_t levelHash;
+	uint64_t indexOffset;
+	uint32_t indexEntries;
+	uint32_t reserved;
+};
+
+struct RecordingIndexEntry {
+	uint32_t firstTick;
+	uint32_t frames;
+	// of the keyframe
+	uint64_t offset;
+};
+
+static_assert(sizeof(RecordingHeader) == 40, "RecordingHeader is read straight from the file");
+static_assert(sizeof(RecordingIndexEntry) == 16, "RecordingIndexEntry is read straight from the file");
+
+inline bool recordingHeaderValid(const RecordingHeader& header) {
+	return memcmp(header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) == 0 && header.version == RECORDING_VERSION;
+}
+
+// the chunk holding tick, nullptr if the recording starts after it
+inline const RecordingIndexEntry* findRecordingChunk(const RecordingIndexEntry* index, uint32_t entries, uint32_t tick) {
+	auto it = std::upper_bound(index, index + entries, tick,
+		[](uint32_t t, const RecordingIndexEntry& e){ return t < e.firstTick; });
+	return it == index ? nullptr : it - 1;
+}
@@ -0,0 +1,406 @@
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+
+#include "flatbuffers/flatbuffers.h"
+#include "../common/deadfish_generated.h"
+#include "../common/constants.hpp"
+
+#include "bot.hpp"
+
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+LoadStats loadStats;
+
+// how far from its position a random bot walks or aims a skill
+const float WANDER_RADIUS = 8.0f;
+
+static std::string makeClientMessage(flatbuffers::FlatBufferBuilder& builder,
+	FlatBuffGenerated::ClientMessageUnion type, flatbuffers::Offset<void> offset)
+{
+	auto message = FlatBuffGenerated::CreateClientMessage(builder, type, offset);
+	builder.Finish(message);
+	auto data = builder.GetBufferPointer();
+	return std::string(data, data + builder.GetSize());
+}
+
+class Bot : public std::enable_shared_from_this<Bot> {
+    tcp::resolver resolver_;
+    websocket::stream<beast::tcp_stream> ws_;
+    beast::flat_buffer buffer_;
+    net::steady_timer actionTimer_;
+    std::deque<std::string> outbox_;
+    BotConfig config_;
+    std::mt19937 rng_;
+
+    uint16_t mobID_ = 0;
+    bool readySent_ = false;
+    bool playing_ = false;
+    bool closed_ = false;
+    float x_ = 0;
+    float y_ = 0;
+    std::vector<uint16_t> visibleMobs_;
+    size_t skills_ = 0;
+    size_t scriptPos_ = 0;
+    std::chrono::steady_clock::time_point lastSnapshot_;
+
+public:
+    Bot(net::io_context& ioc, const BotConfig& config, uint32_t seed)
+        : resolver_(ioc), ws_(ioc), actionTimer_(ioc), config_(config), rng_(seed)
+    {
+        ws_.binary(true);
+    }
+
+    void Start()
+    {
+        resolver_.async_resolve(config_.host, config_.port,
+            beast::bind_front_handler(&Bot::OnResolve, shared_from_this()));
+    }
+
+private:
+    void Fail(beast::error_code ec, const char* what)
+    {
+        if (closed_)
+            return;
+        std::cerr << config_.name << " " << what << ": " << ec.message() << "\n";
+        loadStats.failed++;
+        Close();
+    }
+
+    void Close()
+    {
+        if (closed_)
+            return;
+        closed_ = true;
+        if (playing_)
+            loadStats.playing--;
+        actionTimer_.cancel();
+        beast::get_lowest_layer(ws_).close();
+    }
+
+    void OnResolve(beast::error_code ec, tcp::resolver::results_type results)
+    {
+        if (ec)
+            return Fail(ec, "resolve");
+        beast::get_lowest_layer(ws_).expires_after(std::chrono::seconds(30));
+        beast::get_lowest_layer(ws_).async_connect(results,
+            beast::bind_front_handler(&Bot::OnConnect, shared_from_this()));
+    }
+
+    void OnConnect(beast::error_code ec, tcp::resolver::results_type::endpoint_type)
+    {
+        if (ec)
+            return Fail(ec, "connect");
+        // the websocket has its own timeouts from here on
+        beast::get_lowest_layer(ws_).expires_never();
+        ws_.set_option(websocket::stream_base::timeout::suggested(beast::role_type::client));
+        ws_.async_handshake(config_.host + ":" + config_.port, "/",
+            beast::bind_front_handler(&Bot::OnHandshake, shared_from_this()));
+    }
+
+    void OnHandshake(beast::error_code ec)
+    {
+        if (ec)
+            return Fail(ec, "handshake");
+        loadStats.connected++;
+
+        flatbuffers::FlatBufferBuilder builder;
+        auto req = FlatBuffGenerated::CreateJoinRequest(builder, builder.CreateString(config_.name));
+        Send(makeClientMessage(builder, FlatBuffGenerated::ClientMessageUnion_JoinRequest, req.Union()));
+        DoRead();
+    }
+
+    void DoRead()
+    {
+        ws_.async_read(buffer_,
+            beast::bind_front_handler(&Bot::OnRead, shared_from_this()));
+    }
+
+    void OnRead(beast::error_code ec, std::size_t bytes_transferred)
+    {
+        if (ec == websocket::error::closed || closed_) {
+            Close();
+            return;
+        }
+        if (ec)
+            return Fail(ec, "read");
+
+        loadStats.bytesReceived += bytes_transferred;
+        loadStats.messagesReceived++;
+        auto data = (const uint8_t*) buffer_.data().data();
+        flatbuffers::Verifier verifier(data, buffer_.size());
+        if (verifier.VerifyBuffer<FlatBuffGenerated::ServerMessage>(nullptr))
+            HandleMessage(flatbuffers::GetRoot<FlatBuffGenerated::ServerMessage>(data));
+        else
+            std::cerr << config_.name << " received a corrupted message\n";
+        buffer_.consume(buffer_.size());
+
+        if (!closed_)
+            DoRead();
+    }
+
+    void HandleMessage(const FlatBuffGenerated::ServerMessage* message)
+    {
+        switch (message->event_type())
+        {
+        case FlatBuffGenerated::ServerMessageUnion_InitMetadata:
+        {
+            auto event = message->event_as_InitMetadata();
+            mobID_ = event->yourMobID();
+            if (!readySent_ && event->players() && event->players()->size() >= config_.lobbySize) {
+                readySent_ = true;
+                flatbuffers::FlatBufferBuilder builder;
+                auto ready = FlatBuffGenerated::CreatePlayerReady(builder);
+                Send(makeClientMessage(builder, FlatBuffGenerated::ClientMessageUnion_PlayerReady, ready.Union()));
+            }
+        }
+        break;
+        case FlatBuffGenerated::ServerMessageUnion_LevelAnnounce:
+        {
+            flatbuffers::FlatBufferBuilder builder;
+            auto status = FlatBuffGenerated::CreateLevelCacheStatus(builder,
+                message->event_as_LevelAnnounce()->hash(), !config_.downloadLevel);
+            Send(makeClientMessage(builder, FlatBuffGenerated::ClientMessageUnion_LevelCacheStatus, status.Union()));
+        }
+        break;
+        case FlatBuffGenerated::ServerMessageUnion_Ping:
+        {
+            flatbuffers::FlatBufferBuilder builder;
+            auto pong = FlatBuffGenerated::CreatePong(builder, message->event_as_Ping()->serverTime());
+            Send(makeClientMessage(builder, FlatBuffGenerated::ClientMessageUnion_Pong, pong.Union()));
+        }
+        break;
+        case FlatBuffGenerated::ServerMessageUnion_WorldState:
+            HandleWorldState(message->event_as_WorldState());
+        break;
+        case FlatBuffGenerated::ServerMessageUnion_SkillBarUpdate:
+        {
+            auto skills = message->event_as_SkillBarUpdate()->skills();
+            skills_ = skills ? skills->size() : 0;
+        }
+        break;
+        case FlatBuffGenerated::ServerMessageUnion_SimpleServerEvent:
+        {
+            auto type = message->event_as_SimpleServerEvent()->type();
+            if (type == FlatBuffGenerated::SimpleServerEventType_GameAlreadyInProgress) {
+                std::cerr << config_.name << " was turned away, the match already started\n";
+                loadStats.failed++;
+            } else {
+                loadStats.finished++;
+            }
+            Close();
+        }
+        break;
+
+        default:
+            break;
+        }
+    }
+
+    void HandleWorldState(const FlatBuffGenerated::WorldState* worldState)
+    {
+        auto now = std::chrono::steady_clock::now();
+        loadStats.snapshots++;
+        if (!playing_) {
+            playing_ = true;
+            loadStats.playing++;
+            ScheduleAction(0);
+        } else {
+            float intervalMs = std::chrono::duration<float, std::milli>(now - lastSnapshot_).count();
+            loadStats.jitterMs.push_back(std::fabs(intervalMs - FRAME_TIME));
+        }
+        lastSnapshot_ = now;
+
+        visibleMobs_.clear();
+        if (!worldState->mobs())
+            return;
+        for (auto mob : *worldState->mobs()) {
+            auto movable = mob->movable();
+            if (movable->ID() == mobID_) {
+                x_ = movable->pos().x();
+                y_ = movable->pos().y();
+            } else {
+                visibleMobs_.push_back(movable->ID());
+            }
+        }
+    }
+
+    void ScheduleAction(uint32_t delayMs)
+    {
+        actionTimer_.expires_after(std::chrono::milliseconds(delayMs));
+        actionTimer_.async_wait(beast::bind_front_handler(&Bot::OnActionTimer, shared_from_this()));
+    }
+
+    void OnActionTimer(beast::error_code ec)
+    {
+        if (ec || closed_)
+            return;
+        if (config_.script.empty()) {
+            Act(RandomAction());
+            std::uniform_int_distribution<uint32_t> interval(config_.actionIntervalMs / 2, config_.actionIntervalMs * 3 / 2);
+            ScheduleAction(interval(rng_));
+            return;
+        }
+        // run the script up to its next wait, a script without waits runs once per action interval
+        for (size_t i = 0; i < config_.script.size(); i++) {
+            auto& action = config_.script[scriptPos_];
+            scriptPos_ = (scriptPos_ + 1) % config_.script.size();
+            if (action.type == BotAction::Type::WAIT) {
+                ScheduleAction(action.waitMs);
+                return;
+            }
+            Act(action);
+        }
+        ScheduleAction(config_.actionIntervalMs);
+    }
+
+    BotAction RandomAction()
+    {
+        std::uniform_real_distribution<float> offset(-WANDER_RADIUS, WANDER_RADIUS);
+        BotAction action;
+        action.x = offset(rng_);
+        action.y = offset(rng_);
+        auto roll = std::uniform_int_distribution<int>(0, 99)(rng_);
+        if (roll < 60)
+            action.type = BotAction::Type::MOVE;
+        else if (roll < 70)
+            action.type = BotAction::Type::RUN;
+        else if (roll < 80)
+            action.type = BotAction::Type::WALK;
+        else if (roll < 95)
+            action.type = BotAction::Type::KILL;
+        else
+            action.type = BotAction::Type::SKILL;
+        return action;
+    }
+
+    void Act(const BotAction& action)
+    {
+        flatbuffers::FlatBufferBuilder builder;
+        FlatBuffGenerated::Vec2 target(x_ + action.x, y_ + action.y);
+        switch (action.type)
+        {
+        case BotAction::Type::MOVE:
+        {
+            auto move = FlatBuffGenerated::CreateCommandMove(builder, &target);
+            Send(makeClientMessage(builder, FlatBuffGenerated::ClientMessageUnion_CommandMove, move.Union()));
+        }
+        break;
+        case BotAction::Type::RUN:
+        case BotAction::Type::WALK:
+        {
+            auto run = FlatBuffGenerated::CreateCommandRun(builder, action.type == BotAction::Type::RUN);
+            Send(makeClientMessage(builder, FlatBuffGenerated::ClientMessageUnion_CommandRun, run.Union()));
+        }
+        break;
+        case BotAction::Type::KILL:
+        {
+            if (visibleMobs_.empty())
+                return;
+            auto victim = visibleMobs_[std::uniform_int_distribution<size_t>(0, visibleMobs_.size() - 1)(rng_)];
+            auto kill = FlatBuffGenerated::CreateCommandKill(builder, victim);
+            Send(makeClientMessage(builder, FlatBuffGenerated::ClientMessageUnion_CommandKill, kill.Union()));
+        }
+        break;
+        case BotAction::Type::SKILL:
+        {
+            if (action.skill >= skills_)
+                return;
+            auto skill = FlatBuffGenerated::CreateCommandSkill(builder, action.skill, &target);
+            Send(makeClientMessage(builder, FlatBuffGenerated::ClientMessageUnion_CommandSkill, skill.Union()));
+        }
+        break;
+
+        default:
+            return;
+        }
+        loadStats.commandsSent++;
+    }
+
+    void Send(std::string data)
+    {
+        outbox_.push_back(std::move(data));
+        if (outbox_.size() == 1)
+            DoWrite();
+    }
+
+    void DoWrite()
+    {
+        ws_.async_write(net::buffer(outbox_.front()),
+            beast::bind_front_handler(&Bot::OnWrite, shared_from_this()));
+    }
+
+    void OnWrite(beast::error_code ec, std::size_t bytes_transferred)
+    {
+        if (ec)
+            return Fail(ec, "write");
+        loadStats.bytesSent += bytes_transferred;
+        outbox_.pop_front();
+        if (!outbox_.empty() && !closed_)
+            DoWrite();
+    }
+};
+
+void startBot(net::io_context& ioc, const BotConfig& config, uint32_t seed)
+{
+    std::make_shared<Bot>(ioc, config, seed)->Start();
+}
+
+bool parseScript(const std::string& path, std::vector<BotAction>& script)
+{
+	std::ifstream in(path);
+	if (!in) {
+		std::cout << "could not open script " << path << "\n";
+		return false;
+	}
+	std::string line;
+	for (int lineNumber = 1; std::getline(in, line); lineNumber++) {
+		std::istringstream words(line);
+		std::string command;
+		if (!(words >> command) || command[0] == '#')
+			continue;
+		BotAction action;
+		bool ok = true;
+		if (command == "move") {
+			action.type = BotAction::Type::MOVE;
+			ok = (bool) (words >> action.x >> action.y);
+		} else if (command == "run") {
+			action.type = BotAction::Type::RUN;
+		} else if (command == "walk") {
+			action.type = BotAction::Type::WALK;
+		} else if (command == "kill") {
+			action.type = BotAction::Type::KILL;
+		} else if (command == "skill") {
+			action.type = BotAction::Type::SKILL;
+			unsigned slot;
+			ok = (bool) (words >> slot >> action.x >> action.y);
+			action.skill = slot;
+		} else if (command == "wait") {
+			action.type = BotAction::Type::WAIT;
+			ok = (bool) (words >> action.waitMs);
+		} else {
+			ok = false;
+		}
+		if (!ok) {
+			std::cout << path << ":" << lineNumber << ": cannot parse \"" << line << "\"\n";
+			return false;
+		}
+		script.push_back(action);
+	}
+	if (script.empty()) {
+		std::cout << "script " << path << " has no actions\n";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+
+// one step of a bot script, see parseScript
+struct BotAction {
+	enum class Type {
+		MOVE,
+		RUN,
+		WALK,
+		KILL,
+		SKILL,
+		WAIT
+	};
+	Type type;
+	// offset from the bot for MOVE, mouse offset for SKILL
+	float x = 0;
+	float y = 0;
+	uint8_t skill = 0;
+	uint32_t waitMs = 0;
+};
+
+struct BotConfig {
+	std::string host;
+	std::string port;
+	std::string name;
+	// the bot sends PlayerReady once this many players are in the lobby
+	uint32_t lobbySize;
+	// answer LevelAnnounce with a cache miss so the server sends the whole level
+	bool downloadLevel;
+	// average time between two random actions
+	uint32_t actionIntervalMs;
+	// played in a loop instead of random actions if not empty
+	std::vector<BotAction> script;
+};
+
+// totals over all the bots, they all run on the thread of one io_context so nothing is synchronized
+struct LoadStats {
+	uint32_t connected = 0;
+	uint32_t failed = 0;
+	uint32_t playing = 0;
+	uint32_t finished = 0;
+	uint64_t bytesReceived = 0;
+	uint64_t messagesReceived = 0;
+	uint64_t bytesSent = 0;
+	uint64_t commandsSent = 0;
+	uint64_t snapshots = 0;
+	// how far the interval between two WorldStates of a connection was from FRAME_TIME, in milliseconds
+	std::vector<float> jitterMs;
+};
+
+extern LoadStats loadStats;
+
+// connects a bot, joins the lobby and plays until the match ends or the io_context is stopped
+void startBot(boost::asio::io_context& ioc, const BotConfig& config, uint32_t seed);
+
+// one action per line: "move <dx> <dy>", "run", "walk", "kill", "skill <slot> <dx> <dy>" or "wait <ms>",
+// empty lines and lines starting with # are skipped
+bool parseScript(const std::string& path, std::vector<BotAction>& script);
@@ -0,0 +1,12 @@
+#!/bin/bash
+
+set -e
+
+if [ "$1" != "--keep" ]
+then
+    rm -rf build
+    mkdir build
+fi
+cd build
+cmake -DCMAKE_BUILD_TYPE=Release ..
+make -j
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/program_options.hpp>
+
+#include "../common/constants.hpp"
+
+#include "bot.hpp"
+
+namespace boost_po = boost::program_options;
+namespace net = boost::asio;
+
+const uint32_t REPORT_INTERVAL_SECONDS = 5;
+
+static boost_po::variables_map options;
+
+// returns true if we can proceed
+static bool handleCliOptions(int argc, const char* const argv[])
+{
+	boost_po::options_description desc("Deadfish load generator options");
+	desc.add_options()
+		("help,h", "show help message")
+		("host", boost_po::value<std::string>()->default_value("localhost"), "host of the servers")
+		("port,p", boost_po::value<int>()->default_value(63987), "port of the first server")
+		("servers,s", boost_po::value<uint32_t>()->default_value(1), "number of servers listening on consecutive ports from --port, the bots are spread over them")
+		("bots,b", boost_po::value<uint32_t>()->default_value(MAX_PLAYERS), "number of bot connections")
+		("lobbysize", boost_po::value<uint32_t>(), "bots get ready once this many players are in their lobby, by default all the bots of a server")
+		("connectrate", boost_po::value<uint32_t>()->default_value(50), "new connections opened per second")
+		("interval", boost_po::value<uint32_t>()->default_value(500), "average milliseconds between two actions of a bot")
+		("script", boost_po::value<std::string>(), "play the actions of this file in a loop instead of random ones")
+		("downloadlevel", boost_po::value<bool>()->default_value(false)->implicit_value(true), "make the server send the level to every bot instead of reporting it cached")
+		("duration,d", boost_po::value<uint32_t>()->default_value(60), "seconds to run for, 0 runs until every bot is done")
+		("seed", boost_po::value<uint32_t>(), "seed of the random actions")
+	;
+
+	boost_po::store(boost_po::parse_command_line(argc, argv, desc), options);
+	boost_po::notify(options);
+
+	if (options.count("help")) {
+		std::cout << desc << "\n";
+		return false;
+	}
+	if (options["servers"].as<uint32_t>() == 0 || options["bots"].as<uint32_t>() == 0) {
+		std::cout << "there has to be at least one server and one bot\n";
+		return false;
+	}
+	return true;
+}
+
+static float percentile(std::vector<float>& samples, float p)
+{
+	if (samples.empty())
+		return 0;
+	auto it = samples.begin() + (size_t) ((samples.size() - 1) * p);
+	std::nth_element(samples.begin(), it, samples.end());
+	return *it;
+}
+
+static void printReport(double seconds, const LoadStats& last, uint32_t bots)
+{
+	auto jitter = loadStats.jitterMs;
+	std::cout << std::fixed << std::setprecision(1)
+		<< "[" << seconds << "s] connected " << loadStats.connected << "/" << bots
+		<< " playing " << loadStats.playing << " failed " << loadStats.failed << " finished " << loadStats.finished
+		<< " | recv " << (loadStats.bytesReceived - last.bytesReceived) / 1024.0 / REPORT_INTERVAL_SECONDS << " KiB/s "
+		<< (loadStats.messagesReceived - last.messagesReceived) / REPORT_INTERVAL_SECONDS << " msg/s"
+		<< " | sent " << (loadStats.commandsSent - last.commandsSent) / REPORT_INTERVAL_SECONDS << " cmd/s"
+		<< " | snapshot jitter p50 " << percentile(jitter, 0.5f) << "ms p99 " << percentile(jitter, 0.99f) << "ms\n";
+}
+
+static void printSummary(double seconds, std::vector<float>& jitter)
+{
+	std::cout << std::fixed << std::setprecision(2)
+		<< "ran " << seconds << "s, " << loadStats.connected << " connected, " << loadStats.failed << " failed\n"
+		<< "received " << loadStats.bytesReceived / 1024.0 / 1024.0 << " MiB in " << loadStats.messagesReceived << " messages, "
+		<< loadStats.snapshots << " snapshots\n"
+		<< "sent " << loadStats.bytesSent / 1024.0 << " KiB, " << loadStats.commandsSent << " commands\n";
+	if (jitter.empty())
+		return;
+	auto maxJitter = *std::max_element(jitter.begin(), jitter.end());
+	std::cout << "snapshot jitter p50 " << percentile(jitter, 0.5f) << "ms p90 " << percentile(jitter, 0.9f)
+		<< "ms p99 " << percentile(jitter, 0.99f) << "ms max " << maxJitter << "ms\n";
+}
+
+int main(int argc, const char* const argv[])
+{
+	if (!handleCliOptions(argc, argv))
+		return 1;
+
+	uint32_t bots = options["bots"].as<uint32_t>();
+	uint32_t servers = options["servers"].as<uint32_t>();
+	BotConfig config;
+	config.host = options["host"].as<std::string>();
+	config.lobbySize = options.count("lobbysize") ? options["lobbysize"].as<uint32_t>()
+		: std::min<uint32_t>((bots + servers - 1) / servers, MAX_PLAYERS);
+	config.downloadLevel = options["downloadlevel"].as<bool>();
+	config.actionIntervalMs = std::max<uint32_t>(options["interval"].as<uint32_t>(), 1);
+	if (options.count("script") && !parseScript(options["script"].as<std::string>(), config.script))
+		return 1;
+	uint32_t seed = options.count("seed") ? options["seed"].as<uint32_t>() : std::random_device{}();
+	uint32_t connectRate = std::max<uint32_t>(options["connectrate"].as<uint32_t>(), 1);
+
+	net::io_context ioc{1};
+	auto start = std::chrono::steady_clock::now();
+	auto elapsed = [&]{ return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+
+	// open the connections gradually, a burst of hundreds of handshakes would only measure the accept queue
+	net::steady_timer connectTimer(ioc);
+	uint32_t started = 0;
+	std::function<void()> connectMore = [&]{
+		for (uint32_t i = 0; i < std::max<uint32_t>(connectRate / 10, 1) && started < bots; i++, started++) {
+			config.port = std::to_string(options["port"].as<int>() + started % servers);
+			config.name = "bot" + std::to_string(started);
+			startBot(ioc, config, seed + started);
+		}
+		if (started == bots)
+			return;
+		connectTimer.expires_after(std::chrono::milliseconds(100));
+		connectTimer.async_wait([&](boost::system::error_code ec){ if (!ec) connectMore(); });
+	};
+	connectMore();
+
+	uint32_t duration = options["duration"].as<uint32_t>();
+	net::steady_timer reportTimer(ioc);
+	LoadStats last;
+	// the stats only keep the jitter since the last report
+	std::vector<float> runJitter;
+	std::function<void()> report = [&]{
+		printReport(elapsed(), last, bots);
+		runJitter.insert(runJitter.end(), loadStats.jitterMs.begin(), loadStats.jitterMs.end());
+		loadStats.jitterMs.clear();
+		last = loadStats;
+		bool allDone = started == bots && loadStats.failed + loadStats.finished >= bots;
+		if (allDone || (duration && elapsed() >= duration)) {
+			ioc.stop();
+			return;
+		}
+		reportTimer.expires_after(std::chrono::seconds(REPORT_INTERVAL_SECONDS));
+		reportTimer.async_wait([&](boost::system::error_code ec){ if (!ec) report(); });
+	};
+	reportTimer.expires_after(std::chrono::seconds(REPORT_INTERVAL_SECONDS));
+	reportTimer.async_wait([&](boost::system::error_code ec){ if (!ec) report(); });
+
+	ioc.run();
+	runJitter.insert(runJitter.end(), loadStats.jitterMs.begin(), loadStats.jitterMs.end());
+	printSummary(elapsed(), runJitter);
+	return loadStats.failed > 0 ? 1 : 0;
+}
@@ -4,11 +4,26 @@ namespace dfAgones = agones;
 
 #include <agones/sdk.h>
 #include <grpc++/grpc++.h>
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <thread>
 
+#include "../common/constants.hpp"
+
 static std::shared_ptr<agones::SDK> sdk;
 
+// the load figures, written by the game and websocket threads and published by DoPublishLoad
+static std::mutex loadMut;
+static int players = 0;
+static bool playing = false;
+static double tickCpu = 0;
+static double p99TickMs = 0;
+
+const int LOAD_PUBLISH_SECONDS = 5;
+
 // send health check pings
 static void DoHealth()
 {
@@ -22,6 +37,47 @@ static void DoHealth()
 	}
 }
 
+static std::string formatLoad(double v)
+{
+	std::ostringstream os;
+	os.precision(3);
+	os << v;
+	return os.str();
+}
+
+// publishes the load labels and annotations whenever they change
+static void DoPublishLoad()
+{
+	std::map<std::string, std::string> published;
+	auto publish = [&](const std::string& key, const std::string& value, bool label) {
+		if (published[key] == value)
+			return;
+		auto status = label ? sdk->SetLabel(key, value) : sdk->SetAnnotation(key, value);
+		if (!status.ok()) {
+			std::cout << "failed to publish " << key << ": " << status.error_message() << "\n";
+			return;
+		}
+		published[key] = value;
+	};
+	while (true)
+	{
+		int rooms, freeCapacity;
+		double cpu, p99;
+		{
+			std::lock_guard<std::mutex> guard(loadMut);
+			rooms = playing ? 1 : 0;
+			freeCapacity = playing ? 0 : std::max(0, MAX_PLAYERS - players);
+			cpu = playing ? tickCpu : 0;
+			p99 = playing ? p99TickMs : 0;
+		}
+		publish("rooms", std::to_string(rooms), true);
+		publish("free-capacity", std::to_string(freeCapacity), true);
+		publish("tick-cpu", formatLoad(cpu), false);
+		publish("p99-tick-ms", formatLoad(p99), false);
+		std::this_thread::sleep_for(std::chrono::seconds(LOAD_PUBLISH_SECONDS));
+	}
+}
+
 // watch GameServer Updates
 static void WatchUpdates()
 {
@@ -86,6 +142,7 @@ bool dfAgones::Start()
 	// leak those
 	new std::thread(DoHealth);
 	new std::thread(WatchUpdates);
+	new std::thread(DoPublishLoad);
 
 	return true;
 }
@@ -98,6 +155,10 @@ void dfAgones::Shutdown() {
 }
 
 void dfAgones::SetPlayers(int players) {
+	{
+		std::lock_guard<std::mutex> guard(loadMut);
+		::players = players;
+	}
 	if (!sdk)
 		return;
 	auto status = sdk->SetLabel("players", std::to_string(players));
@@ -107,7 +168,30 @@ void dfAgones::SetPlayers(int players) {
 		std::cout << "set label players to " << players << "\n";
 }
 
+void dfAgones::SetReady() {
+	{
+		std::lock_guard<std::mutex> guard(loadMut);
+		playing = false;
+	}
+	if (!sdk)
+		return;
+	auto status = sdk->Ready();
+	if (!status.ok()) {
+		std::cout << "failed to mark the server ready again: " << status.error_message() << "\n";
+		return;
+	}
+	status = sdk->SetLabel("playing", "false");
+	if (!status.ok())
+		std::cout << "failed to set playing to false\n";
+	else
+		std::cout << "marked ready, set playing to false\n";
+}
+
 void dfAgones::SetPlaying() {
+	{
+		std::lock_guard<std::mutex> guard(loadMut);
+		playing = true;
+	}
 	if (!sdk)
 		return;
 	auto status = sdk->SetLabel("playing", "true");
@@ -116,3 +200,9 @@ void dfAgones::SetPlaying() {
 	else
 		std::cout << "set playing to true\n";
 }
+
+void dfAgones::SetTickLoad(double cpu, double p99) {
+	std::lock_guard<std::mutex> guard(loadMut);
+	tickCpu = cpu;
+	p99TickMs = p99;
+}
@@ -7,5 +7,10 @@ bool Start();
 void Shutdown();
 void SetPlayers(int players);
 void SetPlaying();
+// marks the server as ready to be allocated again
+void SetReady();
+// rolling tick load of the game thread, published together with the room count and the free
+// capacity every few seconds so that the matchmaker can pack servers on cpu headroom
+void SetTickLoad(double cpu, double p99TickMs);
 
 }; // agones
@@ -0,0 +1,121 @@
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <new>
+
+#include "alloc_tracking.hpp"
+
+namespace alloctrack {
+
+struct PhaseStats {
+	const char* name;
+	uint64_t allocations;
+	uint64_t bytes;
+};
+
+static const size_t MAX_PHASES = 64;
+
+static PhaseStats phases[MAX_PHASES];
+static size_t phaseCount = 0;
+static thread_local bool tracked = false;
+static thread_local const char* currentPhase = "untraced";
+static thread_local uint64_t count = 0;
+
+void trackThisThread(bool track)
+{
+	tracked = track;
+}
+
+uint64_t takeCount()
+{
+	auto ret = count;
+	count = 0;
+	return ret;
+}
+
+#ifdef DEADFISH_ALLOC_TRACKING
+
+static PhaseStats* findPhase(const char* name)
+{
+	for (size_t i = 0; i < phaseCount; i++) {
+		if (phases[i].name == name || strcmp(phases[i].name, name) == 0)
+			return &phases[i];
+	}
+	if (phaseCount == MAX_PHASES)
+		return nullptr;
+	phases[phaseCount].name = name;
+	return &phases[phaseCount++];
+}
+
+static void countAllocation(size_t size)
+{
+	if (!tracked)
+		return;
+	count++;
+	auto phase = findPhase(currentPhase);
+	if (phase) {
+		phase->allocations++;
+		phase->bytes += size;
+	}
+}
+
+#endif
+
+void printPhases(std::ostream& os, uint32_t ticks)
+{
+	os << "allocations per tick by phase:\n";
+	for (size_t i = 0; i < phaseCount; i++) {
+		os << "  " << std::left << std::setw(24) << phases[i].name << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(10) << (double) phases[i].allocations / ticks << " allocations "
+			<< std::setw(12) << (double) phases[i].bytes / ticks << " bytes\n";
+	}
+}
+
+Phase::Phase(const char* name) : previous(currentPhase)
+{
+	currentPhase = name;
+}
+
+Phase::~Phase()
+{
+	currentPhase = previous;
+}
+
+}; // alloctrack
+
+#ifdef DEADFISH_ALLOC_TRACKING
+
+void* operator new(std::size_t size)
+{
+	alloctrack::countAllocation(size);
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+// Counting replacements of the global operator new and delete, compiled in with the
+// DEADFISH_ALLOC_TRACKING cmake option. Only threads that turned tracking on are counted and
+// every allocation is attributed to the innermost ALLOC_PHASE, which TRACE_SCOPE opens as well.
+// The bookkeeping is not synchronized, it is meant for the game thread of the benchmark, which
+// is why --allocbudget refuses to run with workers.
+namespace alloctrack {
+
+#ifdef DEADFISH_ALLOC_TRACKING
+const bool compiled = true;
+#else
+const bool compiled = false;
+#endif
+
+void trackThisThread(bool track);
+// allocations of this thread since the previous call
+uint64_t takeCount();
+// allocations and bytes per phase, averaged over ticks
+void printPhases(std::ostream& os, uint32_t ticks);
+
+struct Phase {
+	Phase(const char* name);
+	~Phase();
+
+	const char* previous;
+};
+
+}; // alloctrack
+
+#define ALLOC_CONCAT_(a, b) a##b
+#define ALLOC_CONCAT(a, b) ALLOC_CONCAT_(a, b)
+
+#ifdef DEADFISH_ALLOC_TRACKING
+#define ALLOC_PHASE(name) alloctrack::Phase ALLOC_CONCAT(allocPhase, __LINE__)(name)
+#else
+#define ALLOC_PHASE(name) do {} while (0)
+#endif
@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "avoidance.hpp"
+#include "deadfish.hpp"
+#include "metrics.hpp"
+#include "spatial_hash.hpp"
+#include "../common/constants.hpp"
+
+namespace avoidance {
+
+// two mobs closer than this are colliding, a bit more than touching so they pass with a gap
+const float COLLISION_DISTANCE = 2 * MOB_RADIUS + 0.1f;
+// only collisions this many seconds ahead are avoided
+const float HORIZON = 1.f;
+// a civilian and a player chasing at a run can't close in more than this within the horizon
+const float NEIGHBOR_RADIUS = (WALK_SPEED + WALK_SPEED * RUN_MODIFIER * CHASE_SPEED_BONUS) * HORIZON + COLLISION_DISTANCE;
+// how much an earlier collision weighs against straying from the preferred velocity
+const float TIME_WEIGHT = 0.5f;
+// the static geometry is probed at these distances ahead, from the center of the mob
+const float LOOKAHEAD[] = {MOB_RADIUS + 0.2f, MOB_RADIUS + 0.6f, MOB_RADIUS + 1.2f};
+const float OBSTACLE_CELL = 0.25f;
+
+// the candidates are the preferred velocity turned by these angles, then the same at half speed
+const float CANDIDATE_ANGLES[] = {0, 0.4f, -0.4f, 0.8f, -0.8f, 1.2f, -1.2f, 1.6f, -1.6f};
+const size_t ANGLES = sizeof(CANDIDATE_ANGLES) / sizeof(CANDIDATE_ANGLES[0]);
+
+static const float COS_ANGULAR_CLOSE = std::cos(ANGULAR_CLOSE);
+
+struct ObstacleGrid {
+	float originX = 0, originY = 0;
+	int width = 0, height = 0;
+	std::vector<uint8_t> cells;
+};
+
+static ObstacleGrid obstacles;
+
+// the bounding box over all children of the fixture, a chain has one per edge
+static b2AABB fixtureBounds(b2Fixture* f)
+{
+	b2AABB box = f->GetAABB(0);
+	for (int32 i = 1; i < f->GetShape()->GetChildCount(); i++)
+		box.Combine(f->GetAABB(i));
+	return box;
+}
+
+// box2d chains are hollow, the grid fills a chain loop like the polygon it outlines
+static bool insideFixture(b2Fixture* f, const b2Vec2& p)
+{
+	if (f->GetType() != b2Shape::e_chain)
+		return f->TestPoint(p);
+	auto chain = (b2ChainShape*) f->GetShape();
+	bool inside = false;
+	for (int32 i = 0, j = chain->m_count - 1; i < chain->m_count; j = i++) {
+		auto& a = chain->m_vertices[i];
+		auto& b = chain->m_vertices[j];
+		if ((a.y > p.y) != (b.y > p.y) && p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x)
+			inside = !inside;
+	}
+	return inside;
+}
+
+void buildObstacleGrid()
+{
+	obstacles = ObstacleGrid();
+	if (gameState.level->collisionMasks.empty())
+		return;
+	b2AABB bounds = fixtureBounds(gameState.level->collisionMasks.front()->fixture);
+	for (auto& cm : gameState.level->collisionMasks)
+		bounds.Combine(fixtureBounds(cm->fixture));
+	obstacles.originX = bounds.lowerBound.x;
+	obstacles.originY = bounds.lowerBound.y;
+	obstacles.width = (int) std::ceil((bounds.upperBound.x - bounds.lowerBound.x) / OBSTACLE_CELL) + 1;
+	obstacles.height = (int) std::ceil((bounds.upperBound.y - bounds.lowerBound.y) / OBSTACLE_CELL) + 1;
+	obstacles.cells.assign(obstacles.width * obstacles.height, 0);
+
+	// only the cells under the bounding box of each mask need a point test
+	for (auto& cm : gameState.level->collisionMasks) {
+		auto box = fixtureBounds(cm->fixture);
+		int x0 = (int) ((box.lowerBound.x - obstacles.originX) / OBSTACLE_CELL);
+		int y0 = (int) ((box.lowerBound.y - obstacles.originY) / OBSTACLE_CELL);
+		int x1 = std::min(obstacles.width - 1, (int) ((box.upperBound.x - obstacles.originX) / OBSTACLE_CELL));
+		int y1 = std::min(obstacles.height - 1, (int) ((box.upperBound.y - obstacles.originY) / OBSTACLE_CELL));
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				b2Vec2 center(obstacles.originX + (x + 0.5f) * OBSTACLE_CELL, obstacles.originY + (y + 0.5f) * OBSTACLE_CELL);
+				if (insideFixture(cm->fixture, center))
+					obstacles.cells[y * obstacles.width + x] = 1;
+			}
+		}
+	}
+}
+
+bool blocked(const b2Vec2& point)
+{
+	int x = (int) std::floor((point.x - obstacles.originX) / OBSTACLE_CELL);
+	int y = (int) std::floor((point.y - obstacles.originY) / OBSTACLE_CELL);
+	if (x < 0 || y < 0 || x >= obstacles.width || y >= obstacles.height)
+		return false;
+	return obstacles.cells[y * obstacles.width + x];
+}
+
+static SpatialHash grid(NEIGHBOR_RADIUS);
+
+// calls f(j, dx, dy) for every other mob of the batch within NEIGHBOR_RADIUS of mob i
+template<typename F>
+static void forNeighbors(const steering::Batch& batch, size_t i, F f)
+{
+	grid.forNear(batch.posX[i], batch.posY[i], [&](uint32_t j) {
+		if (j == i)
+			return;
+		float dx = batch.posX[j] - batch.posX[i];
+		float dy = batch.posY[j] - batch.posY[i];
+		if (dx * dx + dy * dy < NEIGHBOR_RADIUS * NEIGHBOR_RADIUS)
+			f(j, dx, dy);
+	});
+}
+
+// seconds until two discs COLLISION_DISTANCE apart at relative position (px, py) touch when one
+// moves with relative velocity (wx, wy), infinity if they don't within the horizon
+static float timeToCollision(float px, float py, float wx, float wy)
+{
+	float a = wx * wx + wy * wy;
+	float b = px * wx + py * wy;
+	float c = px * px + py * py - COLLISION_DISTANCE * COLLISION_DISTANCE;
+	if (b <= 0)
+		return std::numeric_limits<float>::infinity(); // moving apart
+	if (c < 0)
+		return 0; // already touching and still closing in
+	float disc = b * b - a * c;
+	if (disc < 0)
+		return std::numeric_limits<float>::infinity();
+	float t = (b - std::sqrt(disc)) / a;
+	return t < HORIZON ? t : std::numeric_limits<float>::infinity();
+}
+
+// the earliest collision of mob i moving with (vx, vy), against the mobs and the static geometry
+static float earliestCollision(const steering::Batch& batch, size_t i, float vx, float vy)
+{
+	float earliest = std::numeric_limits<float>::infinity();
+	forNeighbors(batch, i, [&](size_t j, float px, float py) {
+		float wx, wy;
+		if (batch.avoids[j]) {
+			// reciprocal, both avoid so each takes half of the way out: 2v - v_i against v_j
+			wx = 2 * vx - batch.velocityX[i] - batch.velocityX[j];
+			wy = 2 * vy - batch.velocityY[i] - batch.velocityY[j];
+		} else {
+			wx = vx - batch.velocityX[j];
+			wy = vy - batch.velocityY[j];
+		}
+		earliest = std::min(earliest, timeToCollision(px, py, wx, wy));
+	});
+
+	float speed = std::sqrt(vx * vx + vy * vy);
+	if (speed == 0)
+		return earliest;
+	for (float distance : LOOKAHEAD) {
+		float t = (distance - MOB_RADIUS) / speed;
+		if (t >= earliest || t > HORIZON)
+			break;
+		b2Vec2 probe(batch.posX[i] + vx / speed * distance, batch.posY[i] + vy / speed * distance);
+		if (blocked(probe))
+			return t;
+	}
+	return earliest;
+}
+
+void adjust(steering::Batch& batch)
+{
+	static float candidateCos[ANGLES], candidateSin[ANGLES];
+	static bool candidatesReady = false;
+	if (!candidatesReady) {
+		for (size_t a = 0; a < ANGLES; a++) {
+			candidateCos[a] = std::cos(CANDIDATE_ANGLES[a]);
+			candidateSin[a] = std::sin(CANDIDATE_ANGLES[a]);
+		}
+		candidatesReady = true;
+	}
+
+	grid.build(batch.posX.data(), batch.posY.data(), batch.size());
+	// the choices are written after all of them were made, so every mob judges the others
+	// by the velocities steering picked and the result doesn't depend on the batch order
+	static std::vector<float> chosenX, chosenY;
+	chosenX.assign(batch.velocityX.begin(), batch.velocityX.end());
+	chosenY.assign(batch.velocityY.begin(), batch.velocityY.end());
+	uint64_t adjusted = 0;
+
+	for (size_t i = 0; i < batch.size(); i++) {
+		float prefX = batch.velocityX[i], prefY = batch.velocityY[i];
+		if (!batch.avoids[i] || (prefX == 0 && prefY == 0))
+			continue;
+		// most mobs are on a free path and keep what steering gave them
+		float first = earliestCollision(batch, i, prefX, prefY);
+		if (first == std::numeric_limits<float>::infinity())
+			continue;
+
+		float bestPenalty = TIME_WEIGHT / std::max(first, 0.001f);
+		float bestX = prefX, bestY = prefY;
+		for (float scale : {1.f, 0.5f}) {
+			for (size_t a = 0; a < ANGLES; a++) {
+				if (scale == 1 && a == 0)
+					continue;
+				float vx = (prefX * candidateCos[a] - prefY * candidateSin[a]) * scale;
+				float vy = (prefX * candidateSin[a] + prefY * candidateCos[a]) * scale;
+				float t = earliestCollision(batch, i, vx, vy);
+				float penalty = std::hypot(vx - prefX, vy - prefY);
+				if (t != std::numeric_limits<float>::infinity())
+					penalty += TIME_WEIGHT / std::max(t, 0.001f);
+				if (penalty < bestPenalty) {
+					bestPenalty = penalty;
+					bestX = vx;
+					bestY = vy;
+				}
+			}
+		}
+		// standing still is the last resort
+		if (TIME_WEIGHT / std::max(earliestCollision(batch, i, 0, 0), 0.001f) + std::hypot(prefX, prefY) < bestPenalty) {
+			bestX = 0;
+			bestY = 0;
+		}
+		if (bestX == prefX && bestY == prefY)
+			continue;
+		chosenX[i] = bestX;
+		chosenY[i] = bestY;
+		adjusted++;
+	}
+
+	for (size_t i = 0; i < batch.size(); i++) {
+		if (chosenX[i] == batch.velocityX[i] && chosenY[i] == batch.velocityY[i])
+			continue;
+		batch.velocityX[i] = chosenX[i];
+		batch.velocityY[i] = chosenY[i];
+		float speed = std::hypot(chosenX[i], chosenY[i]);
+		if (speed == 0)
+			continue;
+		// turn towards where the mob is going now, the same way steering turns towards the target
+		float headingX = batch.sin[i], headingY = -batch.cos[i];
+		float dot = (headingX * chosenX[i] + headingY * chosenY[i]) / speed;
+		float cross = headingX * chosenY[i] - headingY * chosenX[i];
+		if (dot > COS_ANGULAR_CLOSE)
+			batch.angularVelocity[i] = 0;
+		else
+			batch.angularVelocity[i] = cross > 0 ? TURN_SPEED : -TURN_SPEED;
+	}
+	metrics::avoidanceAdjustments.inc(adjusted);
+}
+
+}
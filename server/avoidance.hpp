@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Box2D/Box2D.h>
+
+#include "steering.hpp"
+
+// Local avoidance of the civilians, run on the steering batch between computing and applying it.
+// Every civilian tries a handful of velocities around the one steering picked and takes the one
+// that keeps furthest from a collision, judged reciprocally against the other mobs nearby (found
+// through a hash grid) and against the static level geometry (a rasterized occupancy grid).
+// Civilians that don't bump into each other don't get stuck, so collisionResolution and its
+// raycasts are only needed where the navgraph itself leads into a wall.
+namespace avoidance {
+
+// rasterizes the collision masks of the loaded level, call after loadLevel
+void buildObstacleGrid();
+// whether the point is inside a collision mask, up to the grid resolution
+bool blocked(const b2Vec2& point);
+
+// adjusts the velocities of the mobs queued with avoids set
+void adjust(steering::Batch& batch);
+
+}
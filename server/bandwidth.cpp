@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <array>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "bandwidth.hpp"
+#include "deadfish.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+
+static const size_t MESSAGE_TYPES = FlatBuffGenerated::ServerMessageUnion_MAX + 1;
+static const size_t FIELDS = (size_t) WorldStateField::MAX;
+
+static const char* FIELD_NAMES[FIELDS] = { "mobs", "indicators", "inkParticles", "mobManipulators", "hidingSpot", "other" };
+
+struct ConnectionTraffic {
+	std::array<uint64_t, MESSAGE_TYPES> messageBytes = {};
+	std::array<uint64_t, MESSAGE_TYPES> messages = {};
+	std::array<uint64_t, FIELDS> fieldBytes = {};
+};
+
+static std::mutex mut;
+// totals of the open connections
+static std::map<dfws::Handle, ConnectionTraffic> connections;
+// totals of the current match, all connections together
+static ConnectionTraffic match;
+
+static const char* messageTypeName(size_t type)
+{
+	return FlatBuffGenerated::EnumNameServerMessageUnion((FlatBuffGenerated::ServerMessageUnion) type);
+}
+
+// renders straight from the tables above instead of keeping a labeled counter per combination
+struct BandwidthMetric : public metrics::Metric {
+	using Metric::Metric;
+
+	void render(std::ostream& os) const override {
+		std::lock_guard<std::mutex> guard(mut);
+		os << "# HELP deadfish_sent_message_bytes_total server message bytes sent by message type\n";
+		os << "# TYPE deadfish_sent_message_bytes_total counter\n";
+		for (auto& c : connections)
+			for (size_t t = 1; t < MESSAGE_TYPES; t++)
+				if (c.second.messages[t])
+					os << "deadfish_sent_message_bytes_total{type=\"" << messageTypeName(t) << "\",connection=\""
+						<< c.first << "\"} " << c.second.messageBytes[t] << "\n";
+		os << "# HELP deadfish_sent_messages_total server messages sent by message type\n";
+		os << "# TYPE deadfish_sent_messages_total counter\n";
+		for (auto& c : connections)
+			for (size_t t = 1; t < MESSAGE_TYPES; t++)
+				if (c.second.messages[t])
+					os << "deadfish_sent_messages_total{type=\"" << messageTypeName(t) << "\",connection=\""
+						<< c.first << "\"} " << c.second.messages[t] << "\n";
+		os << "# HELP deadfish_worldstate_field_bytes_total WorldState bytes by field\n";
+		os << "# TYPE deadfish_worldstate_field_bytes_total counter\n";
+		for (auto& c : connections)
+			for (size_t f = 0; f < FIELDS; f++)
+				os << "deadfish_worldstate_field_bytes_total{field=\"" << FIELD_NAMES[f] << "\",connection=\""
+					<< c.first << "\"} " << c.second.fieldBytes[f] << "\n";
+	}
+};
+
+static BandwidthMetric bandwidthMetric("deadfish_bandwidth", "server message bytes by type and WorldState field");
+
+void accountServerMessage(dfws::Handle hdl, const std::string& data)
+{
+	auto type = flatbuffers::GetRoot<FlatBuffGenerated::ServerMessage>(data.data())->event_type();
+	if ((size_t) type >= MESSAGE_TYPES)
+		return;
+	std::lock_guard<std::mutex> guard(mut);
+	// a message can still be on its way after the connection closed, it must not bring the entry back
+	auto c = connections.find(hdl);
+	if (c != connections.end()) {
+		c->second.messageBytes[type] += data.size();
+		c->second.messages[type]++;
+	}
+	match.messageBytes[type] += data.size();
+	match.messages[type]++;
+}
+
+void accountWorldStateField(dfws::Handle hdl, WorldStateField field, size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(mut);
+	auto c = connections.find(hdl);
+	if (c != connections.end())
+		c->second.fieldBytes[(size_t) field] += bytes;
+	match.fieldBytes[(size_t) field] += bytes;
+}
+
+void trackConnection(dfws::Handle hdl)
+{
+	std::lock_guard<std::mutex> guard(mut);
+	connections[hdl] = ConnectionTraffic();
+}
+
+void forgetConnection(dfws::Handle hdl)
+{
+	std::lock_guard<std::mutex> guard(mut);
+	connections.erase(hdl);
+}
+
+void logBandwidthSummary()
+{
+	std::lock_guard<std::mutex> guard(mut);
+	uint64_t total = 0;
+	for (auto bytes : match.messageBytes)
+		total += bytes;
+	LOG_INFO("bandwidth of the match: %lu bytes", (unsigned long) total);
+
+	std::vector<size_t> types;
+	for (size_t t = 1; t < MESSAGE_TYPES; t++)
+		if (match.messages[t])
+			types.push_back(t);
+	std::sort(types.begin(), types.end(), [](size_t a, size_t b){ return match.messageBytes[a] > match.messageBytes[b]; });
+	for (auto t : types)
+		LOG_INFO("  %-18s %10lu bytes %5.1f%% in %lu messages", messageTypeName(t), (unsigned long) match.messageBytes[t],
+			100.0 * match.messageBytes[t] / total, (unsigned long) match.messages[t]);
+
+	uint64_t worldState = match.messageBytes[FlatBuffGenerated::ServerMessageUnion_WorldState];
+	if (worldState) {
+		for (size_t f = 0; f < FIELDS; f++)
+			LOG_INFO("    WorldState.%-16s %10lu bytes %5.1f%%", FIELD_NAMES[f], (unsigned long) match.fieldBytes[f],
+				100.0 * match.fieldBytes[f] / worldState);
+	}
+	match = ConnectionTraffic();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "websocket.hpp"
+
+// Byte accounting of everything the server sends, per ServerMessageUnion type and per
+// WorldState field, both per connection and in aggregate. Exported as metrics.
+enum class WorldStateField {
+	MOBS = 0,
+	INDICATORS,
+	INK_PARTICLES,
+	MOB_MANIPULATORS,
+	HIDING_SPOT,
+	// the WorldState table itself
+	OTHER,
+	MAX
+};
+
+// called for every server message handed to a connection
+void accountServerMessage(dfws::Handle hdl, const std::string& data);
+void accountWorldStateField(dfws::Handle hdl, WorldStateField field, size_t bytes);
+// starts the totals of an accepted connection, messages to handles not tracked only count for the match
+void trackConnection(dfws::Handle hdl);
+// drops the totals of a closed connection from the metrics
+void forgetConnection(dfws::Handle hdl);
+// logs where the bytes of the match went and starts counting the next one from zero
+void logBandwidthSummary();
@@ -0,0 +1,326 @@
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+#include "checkpoint.hpp"
+#include "deadfish.hpp"
+#include "game_thread.hpp"
+#include "ink.hpp"
+#include "level_loader.hpp"
+#include "skills.hpp"
+
+static std::atomic<bool> checkpointFlag{false};
+
+void requestCheckpoint()
+{
+	checkpointFlag = true;
+}
+
+bool checkpointRequested()
+{
+	return checkpointFlag.exchange(false);
+}
+
+void discardCheckpointRequest()
+{
+	if (checkpointFlag.exchange(false))
+		std::cout << "ignoring the checkpoint requested in the lobby, there was no match to save\n";
+}
+
+static FlatBuffGenerated::BodyState bodyState(b2Body* body)
+{
+	return FlatBuffGenerated::BodyState(b2f(body->GetPosition()), body->GetAngle(),
+		b2f(body->GetLinearVelocity()), body->GetAngularVelocity());
+}
+
+static void applyBodyState(b2Body* body, const FlatBuffGenerated::BodyState* state)
+{
+	body->SetTransform(f2b(state->pos()), state->angle());
+	body->SetLinearVelocity(f2b(state->linearVelocity()));
+	body->SetAngularVelocity(state->angularVelocity());
+}
+
+static flatbuffers::Offset<flatbuffers::Vector<const FlatBuffGenerated::KillCounter*>> killCounters(
+	flatbuffers::FlatBufferBuilder& builder, const std::unordered_map<uint16_t, uint16_t>& counters)
+{
+	std::vector<FlatBuffGenerated::KillCounter> ret;
+	for (auto& c : counters)
+		ret.emplace_back(c.first, c.second);
+	return builder.CreateVectorOfStructs(ret);
+}
+
+static void restoreKillCounters(std::unordered_map<uint16_t, uint16_t>& counters,
+	const flatbuffers::Vector<const FlatBuffGenerated::KillCounter*>* fb_Counters)
+{
+	if (!fb_Counters)
+		return;
+	for (auto c : *fb_Counters)
+		counters[c->playerID()] = c->kills();
+}
+
+static flatbuffers::Offset<FlatBuffGenerated::PlayerCheckpoint> checkpointPlayer(
+	flatbuffers::FlatBufferBuilder& builder, Player& p)
+{
+	auto name = builder.CreateString(p.name);
+	auto skills = builder.CreateVector(p.skills);
+	auto playerKillCounters = killCounters(builder, p.playerKillCounters);
+	auto dominationCounters = killCounters(builder, p.dominationCounters);
+	auto targetPosition = FlatBuffGenerated::Vec2(p.targetPosition.x, p.targetPosition.y);
+
+	FlatBuffGenerated::PlayerCheckpointBuilder pcb(builder);
+	pcb.add_movableID(p.movableID);
+	pcb.add_playerID(p.playerID);
+	pcb.add_name(name);
+	pcb.add_sessionToken(p.sessionToken);
+	pcb.add_species(p.species);
+	FlatBuffGenerated::BodyState body;
+	if (p.body) {
+		body = bodyState(p.body);
+		pcb.add_body(&body);
+	}
+	pcb.add_targetPosition(&targetPosition);
+	pcb.add_state((FlatBuffGenerated::MobState) p.state);
+	pcb.add_killTargetID(p.killTargetID);
+	pcb.add_attackTimeout(p.attackTimeout);
+	pcb.add_points(p.points);
+	pcb.add_deathTimeout(p.deathTimeout);
+	pcb.add_skills(skills);
+	pcb.add_kills(p.kills);
+	pcb.add_killingSpreeCounter(p.killingSpreeCounter);
+	pcb.add_deaths(p.deaths);
+	pcb.add_comebackCounter(p.comebackCounter);
+	pcb.add_multikillTimer(p.multikillTimer);
+	pcb.add_multikillCounter(p.multikillCounter);
+	pcb.add_playerKillCounters(playerKillCounters);
+	pcb.add_dominationCounters(dominationCounters);
+	return pcb.Finish();
+}
+
+static flatbuffers::Offset<FlatBuffGenerated::CivilianCheckpoint> checkpointCivilian(
+	flatbuffers::FlatBufferBuilder& builder, Civilian& c)
+{
+	auto currentNavpoint = builder.CreateString(c.currentNavpoint);
+	auto previousNavpoint = builder.CreateString(c.previousNavpoint);
+	auto body = bodyState(c.body);
+	auto targetPosition = FlatBuffGenerated::Vec2(c.targetPosition.x, c.targetPosition.y);
+	auto lastPos = b2f(c.lastPos);
+
+	FlatBuffGenerated::CivilianCheckpointBuilder ccb(builder);
+	ccb.add_movableID(c.movableID);
+	ccb.add_species(c.species);
+	ccb.add_body(&body);
+	ccb.add_targetPosition(&targetPosition);
+	ccb.add_state((FlatBuffGenerated::MobState) c.state);
+	ccb.add_currentNavpoint(currentNavpoint);
+	ccb.add_previousNavpoint(previousNavpoint);
+	ccb.add_slowFrames(c.slowFrames);
+	ccb.add_lastPos(&lastPos);
+	ccb.add_seenAManip(c.seenAManip);
+	return ccb.Finish();
+}
+
+bool writeCheckpoint(const std::string& path)
+{
+	flatbuffers::FlatBufferBuilder builder(64 * 1024);
+
+	std::vector<flatbuffers::Offset<FlatBuffGenerated::PlayerCheckpoint>> players;
+	iterateOverMovableMap(gameState.players,
+		[&](Player& p){
+			players.push_back(checkpointPlayer(builder, p));
+		}
+	);
+	std::vector<flatbuffers::Offset<FlatBuffGenerated::CivilianCheckpoint>> civilians;
+	iterateOverMovableMap(gameState.civilians,
+		[&](Civilian& c){
+			civilians.push_back(checkpointCivilian(builder, c));
+		}
+	);
+	std::vector<flatbuffers::Offset<FlatBuffGenerated::InkParticleCheckpoint>> inkParticles;
+	for (size_t i = 0; i < ink::particles.size(); i++) {
+		FlatBuffGenerated::BodyState body(FlatBuffGenerated::Vec2(ink::particles.x[i], ink::particles.y[i]), 0,
+			FlatBuffGenerated::Vec2(ink::particles.velocityX[i], ink::particles.velocityY[i]), 0);
+		inkParticles.push_back(FlatBuffGenerated::CreateInkParticleCheckpoint(builder,
+			ink::particles.movableID[i], &body, ink::particles.lifetimeFrames[i]));
+	}
+	std::vector<flatbuffers::Offset<FlatBuffGenerated::MobManipulatorCheckpoint>> mobManipulators;
+	iterateOverMovableMap(gameState.mobManipulators,
+		[&](MobManipulator& m){
+			auto movable = m.fbMovable();
+			mobManipulators.push_back(FlatBuffGenerated::CreateMobManipulatorCheckpoint(builder,
+				movable.get(), m.type, m.framesLeft));
+		}
+	);
+
+	std::ostringstream rng;
+	rng << gameState.rng;
+
+	auto checkpoint = FlatBuffGenerated::CreateCheckpoint(builder,
+		gameState.level->file->levelHash,
+		gameState.roundTimer,
+		gameState.civilianTimer,
+		builder.CreateVector(players),
+		builder.CreateVector(civilians),
+		builder.CreateVector(inkParticles),
+		builder.CreateVector(mobManipulators),
+		gameState.tick,
+		gameState.seed,
+		builder.CreateString(rng.str()),
+		gameState.pendingCivilianSpawns,
+		gameState.nextCivilianSpawn);
+	builder.Finish(checkpoint);
+
+	// write next to the target and rename so that a crash never leaves a truncated checkpoint behind
+	auto tmpPath = path + ".tmp";
+	{
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		out.write((const char*) builder.GetBufferPointer(), builder.GetSize());
+		if (!out) {
+			std::cout << "could not write checkpoint to " << tmpPath << "\n";
+			return false;
+		}
+	}
+	if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+		std::cout << "could not move checkpoint to " << path << "\n";
+		return false;
+	}
+	std::cout << "wrote checkpoint " << path << " (" << builder.GetSize() << " bytes, "
+		<< players.size() << " players, " << civilians.size() << " civilians)\n";
+	return true;
+}
+
+static void restorePlayer(const FlatBuffGenerated::PlayerCheckpoint* fb_P)
+{
+	auto p = std::make_unique<Player>();
+	p->movableID = fb_P->movableID();
+	p->playerID = fb_P->playerID();
+	p->name = fb_P->name() ? fb_P->name()->str() : "";
+	p->sessionToken = fb_P->sessionToken();
+	p->ready = true;
+	p->species = fb_P->species();
+	if (fb_P->targetPosition())
+		p->targetPosition = glm::vec2(fb_P->targetPosition()->x(), fb_P->targetPosition()->y());
+	p->state = (MobState) fb_P->state();
+	p->killTargetID = fb_P->killTargetID();
+	p->attackTimeout = fb_P->attackTimeout();
+	p->points = fb_P->points();
+	p->deathTimeout = fb_P->deathTimeout();
+	if (fb_P->skills())
+		p->skills.assign(fb_P->skills()->begin(), fb_P->skills()->end());
+	p->kills = fb_P->kills();
+	p->killingSpreeCounter = fb_P->killingSpreeCounter();
+	p->deaths = fb_P->deaths();
+	p->comebackCounter = fb_P->comebackCounter();
+	p->multikillTimer = fb_P->multikillTimer();
+	p->multikillCounter = fb_P->multikillCounter();
+	restoreKillCounters(p->playerKillCounters, fb_P->playerKillCounters());
+	restoreKillCounters(p->dominationCounters, fb_P->dominationCounters());
+	if (fb_P->body()) {
+		physicsInitMob(p.get(), b2g(f2b(fb_P->body()->pos())), fb_P->body()->angle(), 0.3f, 3);
+		applyBodyState(p->body, fb_P->body());
+		// without a target the player stands where they are
+		if (!fb_P->targetPosition())
+			p->targetPosition = b2g(p->body->GetPosition());
+	}
+	gameState.players[p->movableID] = std::move(p);
+}
+
+static void restoreCivilian(const FlatBuffGenerated::CivilianCheckpoint* fb_C)
+{
+	// a civilian can't walk on without these, the spawns make up for a dropped one
+	if (!fb_C->body() || !fb_C->currentNavpoint() || !fb_C->previousNavpoint()) {
+		std::cout << "civilian " << fb_C->movableID() << " is incomplete in the checkpoint, dropped\n";
+		return;
+	}
+	auto c = std::make_unique<Civilian>();
+	c->movableID = fb_C->movableID();
+	c->species = fb_C->species();
+	auto pos = f2b(fb_C->body()->pos());
+	c->targetPosition = fb_C->targetPosition() ? glm::vec2(fb_C->targetPosition()->x(), fb_C->targetPosition()->y()) : b2g(pos);
+	c->state = (MobState) fb_C->state();
+	c->currentNavpoint = fb_C->currentNavpoint()->str();
+	c->previousNavpoint = fb_C->previousNavpoint()->str();
+	c->slowFrames = fb_C->slowFrames();
+	c->lastPos = fb_C->lastPos() ? f2b(*fb_C->lastPos()) : pos;
+	c->seenAManip = fb_C->seenAManip();
+	physicsInitMob(c.get(), b2g(pos), fb_C->body()->angle(), 0.3f, 1);
+	applyBodyState(c->body, fb_C->body());
+	countCivilianSpecies(c->species, 1);
+	gameState.civilians[c->movableID] = std::move(c);
+}
+
+bool restoreCheckpoint(const std::string& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		std::cout << "could not open checkpoint " << path << "\n";
+		return false;
+	}
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	flatbuffers::Verifier verifier(data.data(), data.size());
+	if (!verifier.VerifyBuffer<FlatBuffGenerated::Checkpoint>(nullptr)) {
+		std::cout << "checkpoint " << path << " is corrupted\n";
+		return false;
+	}
+	auto checkpoint = flatbuffers::GetRoot<FlatBuffGenerated::Checkpoint>(data.data());
+
+	auto levelPath = gameState.options["level"].as<std::string>();
+	auto file = getLevelFile(levelPath);
+	if (!file)
+		return false;
+	if (file->levelHash != checkpoint->levelHash()) {
+		std::cout << "checkpoint " << path << " was taken on a different level than " << levelPath << "\n";
+		return false;
+	}
+
+	const auto guard = gameState.lock();
+	gameState.b2world = std::make_unique<b2World>(b2Vec2(0, 0));
+	gameState.level = std::make_unique<Level>();
+	loadLevel(levelPath);
+
+	gameState.roundTimer = checkpoint->roundTimer();
+	gameState.civilianTimer = checkpoint->civilianTimer();
+	// the mobs' random streams are keyed by seed and tick, the generator carries the rest
+	gameState.tick = checkpoint->tick();
+	gameState.seed = checkpoint->seed();
+	if (checkpoint->rng()) {
+		std::istringstream rng(checkpoint->rng()->str());
+		rng >> gameState.rng;
+	} else {
+		gameState.rng.seed(gameState.seed);
+	}
+	gameState.pendingCivilianSpawns = checkpoint->pendingCivilianSpawns();
+	gameState.nextCivilianSpawn = checkpoint->nextCivilianSpawn();
+	if (checkpoint->players()) {
+		for (auto fb_P : *checkpoint->players())
+			restorePlayer(fb_P);
+	}
+	if (checkpoint->civilians()) {
+		for (auto fb_C : *checkpoint->civilians())
+			restoreCivilian(fb_C);
+	}
+	if (checkpoint->inkParticles()) {
+		for (auto fb_I : *checkpoint->inkParticles())
+			if (fb_I->body())
+				ink::add(f2b(fb_I->body()->pos()), f2b(fb_I->body()->linearVelocity()), fb_I->movableID(), fb_I->lifetimeFrames());
+	}
+	if (checkpoint->mobManipulators()) {
+		for (auto fb_M : *checkpoint->mobManipulators()) {
+			if (!fb_M->movable())
+				continue;
+			auto m = std::make_unique<MobManipulator>();
+			m->movableID = fb_M->movable()->ID();
+			m->pos = fb_M->movable()->pos();
+			m->angle = fb_M->movable()->angle();
+			m->type = fb_M->type();
+			m->framesLeft = fb_M->framesLeft();
+			gameState.mobManipulators[m->movableID] = std::move(m);
+		}
+	}
+	// ink and hiding spot contacts are not stored, the first world step begins them again
+	std::cout << "restored checkpoint " << path << " (" << gameState.players.size() << " players, "
+		<< gameState.civilians.size() << " civilians)\n";
+	return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+
+// safe to call from a signal handler, the game thread picks the request up at the start of its next tick
+void requestCheckpoint();
+bool checkpointRequested();
+// drops a request that came in while there was no match running
+void discardCheckpointRequest();
+
+// serializes the running match to path, expects the game lock to be held
+bool writeCheckpoint(const std::string& path);
+// rebuilds the world and all the mobs of a checkpointed match, players get reattached when they rejoin
+bool restoreCheckpoint(const std::string& path);
@@ -1,15 +1,26 @@
 #include "deadfish.hpp"
+#include "log.hpp"
 #include "../common/constants.hpp"
 
+// the level objects share the static body of their tile, so their shapes are built in world coordinates
+
+static b2Transform objectTransform(const FlatBuffGenerated::Vec2* pos, float rotation) {
+	return b2Transform(b2Vec2(pos->x(), pos->y()), b2Rot(rotation * TO_RADIANS));
+}
+
+static void setWorldPolygon(b2PolygonShape& polyShape, const b2PolygonShape& localShape, const b2Transform& xf) {
+	b2Vec2 world[b2_maxPolygonVertices];
+	for (int32 i = 0; i < localShape.GetVertexCount(); i++)
+		world[i] = b2Mul(xf, localShape.GetVertex(i));
+	polyShape.Set(world, localShape.GetVertexCount());
+}
+
 // HidingSpot
 
-HidingSpot::HidingSpot(const FlatBuffGenerated::HidingSpot* fb_Hs) {
+HidingSpot::HidingSpot(const FlatBuffGenerated::HidingSpot* fb_Hs, b2Body* tileBody) {
 	this->name = fb_Hs->name()->str();
-	b2BodyDef myBodyDef;
-	myBodyDef.type = b2_staticBody;
-	myBodyDef.position.Set(fb_Hs->pos()->x(), fb_Hs->pos()->y());
-	myBodyDef.angle = fb_Hs->rotation() * TO_RADIANS;
-	body = gameState.b2world->CreateBody(&myBodyDef);
+	body = tileBody;
+	auto xf = objectTransform(fb_Hs->pos(), fb_Hs->rotation());
 
 	b2FixtureDef fixtureDef;
 	fixtureDef.isSensor = true; // makes hiding spot detect collision but allow movement
@@ -18,25 +29,26 @@ HidingSpot::HidingSpot(const FlatBuffGenerated::HidingSpot* fb_Hs) {
 	b2PolygonShape polyShape;
 	if (!fb_Hs->polyverts()) {
 		if(fb_Hs->isCircle()){
+			circleShape.m_p = xf.p;
 			circleShape.m_radius = fb_Hs->size()->x() / 2.f;
 			fixtureDef.shape = &circleShape;
 		} else {
-			boxShape.SetAsBox(fb_Hs->size()->x()/2.f, fb_Hs->size()->y()/2.f);
+			boxShape.SetAsBox(fb_Hs->size()->x()/2.f, fb_Hs->size()->y()/2.f, xf.p, xf.q.GetAngle());
 			fixtureDef.shape = &boxShape;
 		}
 	} else {
 		std::vector<b2Vec2> vertices;
 		auto fb_poly = fb_Hs->polyverts();
 		for (auto vert = fb_poly->begin(); vert != fb_poly->end(); ++vert) {
-			vertices.push_back(b2Vec2(vert->x(), vert->y()));
+			vertices.push_back(b2Mul(xf, b2Vec2(vert->x(), vert->y())));
 		}
 		polyShape.Set(vertices.data(), vertices.size());
 		fixtureDef.shape = &polyShape;
 	}
 	fixtureDef.filter.categoryBits = 0x0010;    // "i be bush"
 	fixtureDef.filter.maskBits = 0x0002;        // "i collide with player"
-	body->CreateFixture(&fixtureDef);
-	body->SetUserData(this);
+	fixtureDef.userData = this;
+	fixture = body->CreateFixture(&fixtureDef);
 }
 
 void HidingSpot::handleCollision(Collideable& other) {
@@ -45,7 +57,7 @@ void HidingSpot::handleCollision(Collideable& other) {
 		playersInside.insert(&player);
 	}
 	catch (...) {
-		std::cout << "non-player collision with bush detected!" << std::endl;
+		LOG_DEBUG("non-player collision with bush detected!");
 	}
 }
 
@@ -60,75 +72,90 @@ bool HidingSpot::obstructsSight(Player* p) {
 
 // CollisionMask
 
-CollisionMask::CollisionMask(const FlatBuffGenerated::CollisionMask* fb_Col) {
-	b2BodyDef myBodyDef;
-	myBodyDef.type = b2_staticBody;
-	myBodyDef.position.Set(fb_Col->pos()->x(), fb_Col->pos()->y());
-	myBodyDef.angle = fb_Col->rotation() * TO_RADIANS;
-	body = gameState.b2world->CreateBody(&myBodyDef);
-
-	b2FixtureDef fixtureDef;
-	b2CircleShape circleShape;
-	b2PolygonShape polyShape;
-	b2PolygonShape boxShape;
+// outlines with more vertices than a box2d polygon takes become chain loops
+static bool isMaskChain(const FlatBuffGenerated::CollisionMask* fb_Col) {
+	return fb_Col->polyverts() && fb_Col->polyverts()->size() > b2_maxPolygonVertices;
+}
 
+static void makeMaskPolygon(const FlatBuffGenerated::CollisionMask* fb_Col, b2PolygonShape& polyShape) {
 	if (!fb_Col->polyverts()) {
-		if(fb_Col->isCircle()){
-			circleShape.m_radius = fb_Col->size()->x() / 2.f;
-			fixtureDef.shape = &circleShape;
-		} else {
-			boxShape.SetAsBox(fb_Col->size()->x()/2.f, fb_Col->size()->y()/2.f);
-			fixtureDef.shape = &boxShape;
-		}
+		polyShape.SetAsBox(fb_Col->size()->x()/2.f, fb_Col->size()->y()/2.f);
 	} else {
 		std::vector<b2Vec2> vertices;
 		for (auto vert : *fb_Col->polyverts()) {
 			vertices.push_back(b2Vec2(vert->x(), vert->y()));
 		}
 		polyShape.Set(vertices.data(), vertices.size());
-		fixtureDef.shape = &polyShape;
 	}
-	fixtureDef.density = 1;
-	body->CreateFixture(&fixtureDef);
-	body->SetUserData(this);
 }
 
-flatbuffers::Offset<FlatBuffGenerated::CollisionMask> CollisionMask::serialize(
-	flatbuffers::FlatBufferBuilder &builder
-) {
-	FlatBuffGenerated::Vec2 pos{body->GetPosition().x, body->GetPosition().y};
-	float rotation = body->GetAngle() * TO_DEGREES;
+static bool isMaskCircle(const FlatBuffGenerated::CollisionMask* fb_Col) {
+	return !fb_Col->polyverts() && fb_Col->isCircle();
+}
 
-	b2Fixture* fixture = body->GetFixtureList();
-	assert(fixture != nullptr);
-	b2Shape* shape = fixture->GetShape();
-	auto type = shape->GetType();
+CollisionMask::CollisionMask(const FlatBuffGenerated::CollisionMask* fb_Col, b2Body* tileBody) {
+	body = tileBody;
+	auto xf = objectTransform(fb_Col->pos(), fb_Col->rotation());
 
-	if (type == b2Shape::e_polygon) {
-		b2PolygonShape* polyShape = dynamic_cast<b2PolygonShape*>(shape);
-		int32_t vertCount = polyShape->GetVertexCount();
+	b2FixtureDef fixtureDef;
+	b2CircleShape circleShape;
+	b2PolygonShape polyShape;
+	b2ChainShape chainShape;
 
-		std::vector<FlatBuffGenerated::Vec2> polyverts_v;
-		polyverts_v.reserve((size_t)vertCount);
+	if (isMaskCircle(fb_Col)) {
+		circleShape.m_p = xf.p;
+		circleShape.m_radius = fb_Col->size()->x() / 2.f;
+		fixtureDef.shape = &circleShape;
+	} else if (isMaskChain(fb_Col)) {
+		std::vector<b2Vec2> vertices;
+		for (auto vert : *fb_Col->polyverts())
+			vertices.push_back(b2Mul(xf, b2Vec2(vert->x(), vert->y())));
+		chainShape.CreateLoop(vertices.data(), vertices.size());
+		fixtureDef.shape = &chainShape;
+	} else {
+		b2PolygonShape localShape;
+		makeMaskPolygon(fb_Col, localShape);
+		setWorldPolygon(polyShape, localShape, xf);
+		fixtureDef.shape = &polyShape;
+	}
+	fixtureDef.density = 1;
+	fixtureDef.userData = this;
+	fixture = body->CreateFixture(&fixtureDef);
+}
 
-		for (int32_t i = 0; i < vertCount; i++) {
-			auto v = polyShape->GetVertex(i);
-			polyverts_v.emplace_back(v.x, v.y);
-		}
-		auto polyverts = builder.CreateVectorOfStructs(polyverts_v);
+// boxes are sent as polygons, with the vertices ordered the way box2d orders them
+flatbuffers::Offset<FlatBuffGenerated::CollisionMask> CollisionMask::serialize(
+	flatbuffers::FlatBufferBuilder &builder,
+	const FlatBuffGenerated::CollisionMask* fb_Col
+) {
+	if (isMaskCircle(fb_Col)) {
+		FlatBuffGenerated::Vec2 size{fb_Col->size()->x(), 0.f};
+		return FlatBuffGenerated::CreateCollisionMask(
+			builder, fb_Col->pos(), &size, fb_Col->rotation(), true, 0);
+	}
 
+	// chains keep the outline as drawn, box2d would have reduced a polygon to its convex hull
+	if (isMaskChain(fb_Col)) {
+		std::vector<FlatBuffGenerated::Vec2> outline;
+		for (auto vert : *fb_Col->polyverts())
+			outline.push_back(*vert);
 		return FlatBuffGenerated::CreateCollisionMask(
-			builder, &pos, nullptr, rotation, false, polyverts);
+			builder, fb_Col->pos(), nullptr, fb_Col->rotation(), false, builder.CreateVectorOfStructs(outline));
+	}
 
-	} else if (type == b2Shape::e_circle) {
-		b2CircleShape* circleShape = dynamic_cast<b2CircleShape*>(shape);
-		FlatBuffGenerated::Vec2 size{circleShape->m_radius * 2.f, 0.f};
+	b2PolygonShape polyShape;
+	makeMaskPolygon(fb_Col, polyShape);
+	int32_t vertCount = polyShape.GetVertexCount();
 
-		return FlatBuffGenerated::CreateCollisionMask(
-			builder, &pos, &size, rotation, true, 0);
+	std::vector<FlatBuffGenerated::Vec2> polyverts_v;
+	polyverts_v.reserve((size_t)vertCount);
 
-	} else {
-		assert(false); // unsupported shape type
-		return 0;
+	for (int32_t i = 0; i < vertCount; i++) {
+		auto v = polyShape.GetVertex(i);
+		polyverts_v.emplace_back(v.x, v.y);
 	}
+	auto polyverts = builder.CreateVectorOfStructs(polyverts_v);
+
+	return FlatBuffGenerated::CreateCollisionMask(
+		builder, fb_Col->pos(), nullptr, fb_Col->rotation(), false, polyverts);
 }
@@ -6,12 +6,15 @@
 #include <memory>
 #include <iostream>
 #include <thread>
+#include <random>
 #include <Box2D/Box2D.h>
 #include <glm/vec2.hpp>
 #include <boost/program_options.hpp>
 #include "../common/deadfish_generated.h"
 #include "../common/constants.hpp"
+#include "../common/fov.hpp"
 #include "../common/types.hpp"
+#include "pool.hpp"
 #include "websocket.hpp"
 
 namespace boost_po = boost::program_options;
@@ -81,6 +84,20 @@ struct Collideable {
 	Collideable(const Collideable&) = delete;
 };
 
+// the level geometry shares a few static bodies, one per tile of the map, and is told apart by
+// the user data of its fixture, mobs keep theirs in the user data of their own body
+inline Collideable* collideableOf(b2Fixture* fixture)
+{
+	if (fixture->GetUserData())
+		return (Collideable*) fixture->GetUserData();
+	return (Collideable*) fixture->GetBody()->GetUserData();
+}
+
+// level geometry, body is the static body of its tile and fixture the part that is this object
+struct StaticCollideable : public Collideable {
+	b2Fixture* fixture = nullptr;
+};
+
 struct Movable {
 	FlatBuffGenerated::Vec2 pos;
 	uint16_t movableID;
@@ -110,26 +127,15 @@ struct Mob : public CollideableMovable {
 	virtual ~Mob();
 };
 
-struct InkParticle :
-	public CollideableMovable {
-	uint16_t lifetimeFrames;
-
-	InkParticle(b2Body* b);
-
-	void handleCollision(Collideable& other) override;
-	void endCollision(Collideable& other) override;
-	bool obstructsSight(Player*) override;
-
-	virtual void update() override;
-
-	~InkParticle();
-};
-
 struct Player : public Mob {
 	std::string name;
 	bool ready = false;
 	uint16_t killTargetID;
-	dfws::Handle wsHandle;
+	dfws::Handle wsHandle = dfws::INVALID_HANDLE;
+	// the full level goes out at most once per connection, however often the client misses its cache
+	bool levelSent = false;
+	// lets the player rejoin the match after it was moved to another server
+	uint64_t sessionToken = 0;
 	uint16_t attackTimeout = 0;
 	std::chrono::system_clock::time_point lastAttack;
 	int points = 0;
@@ -144,6 +150,15 @@ struct Player : public Mob {
 	uint16_t multikillTimer = 0;
 	uint16_t multikillCounter = 0;
 
+	// the visibility polygon around where the player last looked from, see playerOutsideView
+	fov::view view;
+	bool hasView = false;
+
+	// latency telemetry, see latency.hpp
+	std::vector<float> rttSamples;
+	uint64_t commandReceived = 0;
+	bool commandApplied = false;
+
 	// Keeps track of total kills against a player (playerID->kills)
 	std::unordered_map<uint16_t, uint16_t> playerKillCounters;
 	// Keeps track of unrevenged kills against a player (playerID->kills)
@@ -165,54 +180,31 @@ struct Civilian : public Mob {
 	int slowFrames = 0;
 	b2Vec2 lastPos;
 	bool seenAManip;
+	// the body is inactive and moved straight along navgraph edges, see decide
+	bool onRails = false;
+
+	// what decide chose for apply
+	bool wantsRails = false;
+	bool steers = false;
+	bool railsMove = false;
+	b2Vec2 railsPosition;
+	float railsAngle = 0;
 
 	void handleKill(Player& killer) override;
 	void update() override;
-	void setNextNavpoint();
-	void collisionResolution();
-};
-
-// just a data container to be able to send it later to clients
-struct Tileinfo {
-	Tileinfo(const FlatBuffGenerated::Tileinfo* fb_Ti) : name(fb_Ti->name()->str()), gid(fb_Ti->gid()) {}
-	std::string name;
-	uint16_t gid;
-};
-
-// just a data container to be able to send it later to clients
-struct Object {
-	Object(const FlatBuffGenerated::Object* fb_Obj) : pos(fb_Obj->pos()->x(), fb_Obj->pos()->y()),
-		rotation(fb_Obj->rotation()), size(fb_Obj->size()->x(), fb_Obj->size()->y()),
-		gid(fb_Obj->gid()), hspotname(fb_Obj->hspotname()->str()) {}
-	glm::vec2 pos;
-	float rotation;
-	glm::vec2 size;
-	uint16_t gid;
-	std::string hspotname;
+	// decide only reads the world and writes nothing but this civilian, so all the civilians can
+	// decide in parallel. apply then changes the bodies and has to run on the game thread
+	void decide();
+	void apply();
+	// puts every field back to its default for a civilian taken from the pool, the body stays
+	void recycle();
+	void decideOnRails(RandomStream& rng);
+	void setNextNavpoint(RandomStream& rng);
+	void collisionResolution(RandomStream& rng);
 };
 
-// just a data container to be able to send it later to clients
-struct Decoration {
-	Decoration(const FlatBuffGenerated::Decoration* fb_Dec) : pos(fb_Dec->pos()->x(), fb_Dec->pos()->y()),
-		rotation(fb_Dec->rotation()), size(fb_Dec->size()->x(), fb_Dec->size()->y()), gid(fb_Dec->gid()) {}
-	glm::vec2 pos;
-	float rotation;
-	glm::vec2 size;
-	uint16_t gid;
-};
-
-// just a data container to be able to send it later to clients
-struct Tilelayer {
-	Tilelayer(const FlatBuffGenerated::Tilelayer* fb_Tl) : width(fb_Tl->width()), height(fb_Tl->height()),
-		tilesize(fb_Tl->tilesize()->x(), fb_Tl->tilesize()->y()), tiledata(fb_Tl->tiledata()->begin(), fb_Tl->tiledata()->end()) {}
-	uint16_t width;
-	uint16_t height;
-	glm::vec2 tilesize;
-	std::vector<uint16_t> tiledata;
-};
-
-struct HidingSpot : public Collideable {
-	HidingSpot(const FlatBuffGenerated::HidingSpot*);
+struct HidingSpot : public StaticCollideable {
+	HidingSpot(const FlatBuffGenerated::HidingSpot*, b2Body* tileBody);
 	std::string name;
 	std::set<Player*> playersInside;
 	virtual void handleCollision(Collideable& other) override;
@@ -220,14 +212,15 @@ struct HidingSpot : public Collideable {
 	virtual bool obstructsSight(Player* p) override;
 };
 
-struct CollisionMask : public Collideable {
-	CollisionMask(const FlatBuffGenerated::CollisionMask*);
+struct CollisionMask : public StaticCollideable {
+	CollisionMask(const FlatBuffGenerated::CollisionMask*, b2Body* tileBody);
 	virtual bool obstructsSight(Player*) override { return true; }
 
-	flatbuffers::Offset<FlatBuffGenerated::CollisionMask> serialize(flatbuffers::FlatBufferBuilder &builder);
+	static flatbuffers::Offset<FlatBuffGenerated::CollisionMask> serialize(flatbuffers::FlatBufferBuilder &builder,
+		const FlatBuffGenerated::CollisionMask* fb_Col);
 };
 
-struct PlayerWall : public Collideable {
+struct PlayerWall : public StaticCollideable {
 	virtual bool obstructsSight(Player*) override { return false; }
 };
 
@@ -239,16 +232,20 @@ struct NavPoint {
 	bool isplayerspawn;
 };
 
+struct LevelFile;
+
+// only the gameplay geometry, everything the clients render lives in file->levelMessage
 struct Level {
-	std::vector<std::unique_ptr<Object>> objects;
-	std::vector<std::unique_ptr<Decoration>> decoration;
+	std::shared_ptr<const LevelFile> file;
+
 	std::vector<std::unique_ptr<CollisionMask>> collisionMasks;
 	std::vector<std::unique_ptr<HidingSpot>> hidingspots;
 	std::vector<std::unique_ptr<PlayerWall>> playerwalls;
+	// the static bodies holding the geometry above, see collideableOf
+	std::map<std::pair<int, int>, b2Body*> tileBodies;
 	std::unordered_map<std::string, std::unique_ptr<NavPoint>> navpoints;
-	std::vector<std::unique_ptr<Tileinfo>> tileinfo;
-	std::unique_ptr<Tilelayer> tilelayer;
-	glm::vec2 size;
+	// the civilian spawn navpoints sorted by name, the spawn scheduler goes around them in this order
+	std::vector<std::pair<std::string, NavPoint*>> civilianSpawns;
 };
 
 struct MobManipulator
@@ -261,6 +258,30 @@ struct MobManipulator
 	virtual ~MobManipulator() {};
 };
 
+// splitmix64, cheap enough to start a new stream for every mob on every tick
+struct RandomStream {
+	uint64_t state;
+
+	explicit RandomStream(uint64_t seed) : state(seed) {}
+
+	inline uint64_t next() {
+		uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	// uniform in [0, n)
+	inline uint32_t randInt(uint32_t n) {
+		return next() % n;
+	}
+
+	// uniform in [0, 1)
+	inline float randFloat() {
+		return (next() >> 40) / (float) (1 << 24);
+	}
+};
+
 struct GameState {
 private:
 	std::mutex mut;
@@ -273,8 +294,40 @@ public:
 
 	MovableMap<Player> players;
 	MovableMap<Civilian> civilians;
-	MovableMap<InkParticle> inkParticles;
 	MovableMap<MobManipulator> mobManipulators;
+	EntityPool<Civilian> civilianPool;
+
+	uint64_t roundTimer = ROUND_LENGTH;
+	int civilianTimer = 0;
+	// civilians the timer asked for that the spawn scheduler has yet to place
+	uint32_t pendingCivilianSpawns = 0;
+	// the civilian spawn the scheduler tries first next time
+	size_t nextCivilianSpawn = 0;
+	// living civilians per species, goldfish excluded, kept up to date on every spawn and removal
+	std::vector<uint32_t> civilianSpeciesCounts;
+	// ticks simulated in the match so far, presimulation included
+	uint32_t tick = 0;
+
+	// every random decision of the simulation draws from this generator, it is seeded per match
+	// so that a journaled match replays exactly
+	std::mt19937 rng;
+	uint64_t seed = 0;
+
+	// uniform in [0, n)
+	inline uint32_t randInt(uint32_t n) {
+		return rng() % n;
+	}
+
+	// uniform in [0, 1]
+	inline float randFloat() {
+		return rng() / (float) std::mt19937::max();
+	}
+
+	// the stream of a mob for the current tick. Decisions drawn from it don't depend on the order
+	// the mobs are updated in or on the thread doing it, the match still replays the same
+	inline RandomStream mobRandom(uint16_t movableID) {
+		return RandomStream(seed ^ (((uint64_t) tick << 16) | movableID));
+	}
 
 	inline std::unique_ptr<std::lock_guard<std::mutex>> lock() {
 		return std::make_unique<std::lock_guard<std::mutex>>(mut);
@@ -284,3 +337,6 @@ public:
 };
 
 extern GameState gameState;
+
+// puts the server back into the lobby after a recycled match, runs on the websocket thread
+void returnToLobby();
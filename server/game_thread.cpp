@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <array>
+#include <ctime>
 #include <limits>
 
 #define GLM_ENABLE_EXPERIMENTAL
@@ -5,12 +8,26 @@
 #include <glm/gtx/vector_angle.hpp>
 
 #include "../common/geometry.hpp"
+#include "../common/hash.hpp"
 
 #include "deadfish.hpp"
 #include "game_thread.hpp"
+#include "ink.hpp"
+#include "log.hpp"
 #include "level_loader.hpp"
 #include "skills.hpp"
 #include "agones.hpp"
+#include "alloc_tracking.hpp"
+#include "bandwidth.hpp"
+#include "checkpoint.hpp"
+#include "journal.hpp"
+#include "latency.hpp"
+#include "recorder.hpp"
+#include "sight.hpp"
+#include "steering.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "workers.hpp"
 
 const float GOLDFISH_CHANCE = 0.05f;
 const uint32_t PRESIMULATE_TICKS = 1000;
@@ -19,7 +36,7 @@ uint16_t newMovableID()
 {
 	while (true)
 	{
-		uint16_t ret = random() % UINT16_MAX;
+		uint16_t ret = gameState.randInt(UINT16_MAX);
 
 		if (ret == 0)
 		continue;
@@ -36,11 +53,8 @@ uint16_t newMovableID()
 				continue;
 		}
 
-		{
-			auto it = gameState.inkParticles.find(ret);
-			if (it != gameState.inkParticles.end())
-				continue;
-		}
+		if (ink::contains(ret))
+			continue;
 
 		{		
 			auto it = gameState.mobManipulators.find(ret);
@@ -68,7 +82,7 @@ std::string makeServerMessage(flatbuffers::FlatBufferBuilder &builder,
 
 void sendGameAlreadyInProgress(dfws::Handle hdl)
 {
-	std::cout << "sending game already in progress";
+	LOG_INFO("sending game already in progress");
 	flatbuffers::FlatBufferBuilder builder;
 	auto offset = FlatBuffGenerated::CreateSimpleServerEvent(builder,
 		FlatBuffGenerated::SimpleServerEventType_GameAlreadyInProgress);
@@ -86,7 +100,7 @@ void sendServerMessage(Player &player,
 	dfws::SendData(player.wsHandle, str);
 }
 
-void sendToAll(std::string &data)
+void sendToAll(const std::string &data)
 {
 	iterateOverMovableMap(gameState.players,
 		[=](Player& p){
@@ -105,7 +119,7 @@ Player* getPlayerByConnHdl(dfws::Handle hdl)
 		}
 	);
 	if (!ret)
-		std::cout << "getPlayerByConnHdl PLAYER NOT FOUND\n";
+		LOG_WARN("getPlayerByConnHdl PLAYER NOT FOUND");
 	return ret;
 }
 
@@ -123,53 +137,97 @@ std::unique_ptr<FlatBuffGenerated::MovableComponent> CollideableMovable::fbMovab
 	return Movable::fbMovable();
 }
 
+// the mobs are the only occluders sight doesn't know about, with them in the way everything blocks
 struct FOVCallback
 	: public b2RayCastCallback
 {
-	float32 ReportFixture(b2Fixture *fixture, UNUSED const b2Vec2 &point, UNUSED const b2Vec2 &normal, UNUSED float32 fraction)
+	float32 ReportFixture(UNUSED b2Fixture *fixture, UNUSED const b2Vec2 &point, UNUSED const b2Vec2 &normal, float32 fraction)
 	{
-		auto data = (Collideable *)fixture->GetBody()->GetUserData();
-		// on return 1.f the currently reported fixture will be ignored and the raycast will continue
-		if (ignoreMobs && dynamic_cast<Mob*>(data))
-			return 1.f;
-
-		if (data && data != target && player && !data->obstructsSight(player))
-			return 1.f;
-		if (target != data && dynamic_cast<InkParticle*>(target) && data && dynamic_cast<InkParticle*>(data))
-			return 1.f;
-		if (fraction < minfraction)
-		{
-			minfraction = fraction;
-			closest = fixture;
-		}
+		minfraction = std::min(minfraction, fraction);
 		return fraction;
 	}
 	float minfraction = 1.f;
-	b2Fixture *closest = nullptr;
-	Collideable *target = nullptr;
-	Player *player = nullptr;
-	bool ignoreMobs = false;
 };
 
+// dead players have no body and keep looking from where they died
+b2Vec2 playerViewPosition(Player &p)
+{
+	return p.deathTimeout > 0 ? g2b(p.targetPosition) : p.body->GetPosition();
+}
+
+// With --visibilitypolygon a player gets the visibility polygon of the collision masks around it,
+// computed again only once it looks from somewhere else. Whatever is outside the polygon is hidden
+// without casting a ray, inside a ray is still needed for the hiding spots, the ink and the rare
+// edge the outline misses where masks overlap.
+static bool playerOutsideView(Player &p, const b2Vec2 &point)
+{
+	static const bool enabled = gameState.options["visibilitypolygon"].as<bool>();
+	if (!enabled)
+		return false;
+	auto origin = playerViewPosition(p);
+	if (!p.hasView || p.view.origin.x != origin.x || p.view.origin.y != origin.y) {
+		sight::calculateView(p.view, origin);
+		p.hasView = true;
+		metrics::visibilityPolygons.inc();
+	}
+	if (p.view.contains(fov::vec2(point.x, point.y)))
+		return false;
+	metrics::visibilityCulled.inc();
+	return true;
+}
+
 bool playerSeeCollideable(Player &p, Collideable &c)
 {
-	FOVCallback fovCallback;
-	fovCallback.target = &c;
-	fovCallback.player = &p;
-	auto ppos = p.deathTimeout > 0 ? g2b(p.targetPosition) : p.body->GetPosition();
+	auto ppos = playerViewPosition(p);
 	auto cpos = c.body->GetPosition();
-	gameState.b2world->RayCast(&fovCallback, ppos, cpos);
-	return fovCallback.closest && fovCallback.closest->GetBody() == c.body;
+	// where the ray enters the body of c, nothing may be in the way before that
+	b2RayCastInput input;
+	input.p1 = ppos;
+	input.p2 = cpos;
+	input.maxFraction = 1;
+	b2RayCastOutput output;
+	if (!c.body->GetFixtureList()->RayCast(&output, input, 0))
+		return false;
+	// the polygon has to judge the point the ray is cast to, the centre may be behind a wall the
+	// edge sticks out of
+	if (playerOutsideView(p, ppos + output.fraction * (cpos - ppos)))
+		return false;
+	metrics::raycasts.inc();
+	return !sight::blocked(ppos, cpos, output.fraction, &p) && ink::firstHit(ppos, cpos) >= output.fraction;
 }
 
-bool mobSeePoint(Mob &m, const b2Vec2 &point, bool ignoreMobs)
+// ink doesn't hide other ink, the particle is seen if nothing obstructs the way to its edge
+static bool playerSeeInk(Player &p, size_t i)
 {
-	if (b2Distance(m.body->GetPosition(), point) == 0.0f)
+	auto ppos = playerViewPosition(p);
+	b2Vec2 ipos(ink::particles.x[i], ink::particles.y[i]);
+	float dist = b2Distance(ppos, ipos);
+	if (dist <= ink::RADIUS)
 		return true;
-	FOVCallback fovCallback;
-	fovCallback.ignoreMobs = ignoreMobs;
-	gameState.b2world->RayCast(&fovCallback, m.body->GetPosition(), point);
-	return fovCallback.minfraction == 1.f;
+	float edge = 1 - ink::RADIUS / dist;
+	if (playerOutsideView(p, ppos + edge * (ipos - ppos)))
+		return false;
+	metrics::raycasts.inc();
+	return !sight::blocked(ppos, ipos, edge, &p);
+}
+
+bool pointSeePoint(const b2Vec2 &from, const b2Vec2 &to, bool ignoreMobs)
+{
+	if (b2Distance(from, to) == 0.0f)
+		return true;
+	metrics::raycasts.inc();
+	if (!ignoreMobs) {
+		// the mobs move, only the box2d world knows where they are
+		FOVCallback fovCallback;
+		gameState.b2world->RayCast(&fovCallback, from, to);
+		return fovCallback.minfraction == 1.f && ink::firstHit(from, to) > 1;
+	}
+	return !sight::blocked(from, to, 1, nullptr) && ink::firstHit(from, to) > 1;
+}
+
+bool mobSeePoint(Mob &m, const b2Vec2 &point, bool ignoreMobs)
+{
+	return pointSeePoint(m.body->GetPosition(), point, ignoreMobs);
 }
 
 float revLerp(float min, float max, float val)
@@ -186,7 +244,7 @@ makePlayerIndicator(flatbuffers::FlatBufferBuilder &builder,
 					Player &rootPlayer,
 					Player &otherPlayer)
 {
-	glm::vec2 toTarget = b2g(otherPlayer.body->GetPosition()) - b2g(rootPlayer.body->GetPosition());
+	glm::vec2 toTarget = b2g(otherPlayer.body->GetPosition()) - b2g(playerViewPosition(rootPlayer));
 	float force = 1.f - revLerp(6, 12, glm::length(toTarget));
 	float angle = 0;
 	if (force != 0)
@@ -211,14 +269,29 @@ flatbuffers::Offset<FlatBuffGenerated::Mob> createFBMob(flatbuffers::FlatBufferB
 
 flatbuffers::Offset<void> makeWorldState(Player &player, flatbuffers::FlatBufferBuilder &builder, uint64_t framesRemaining)
 {
-	std::vector<flatbuffers::Offset<FlatBuffGenerated::Mob>> mobs;
-	std::vector<flatbuffers::Offset<FlatBuffGenerated::Indicator>> indicators;
+	// the offset vectors are kept between calls so that steady state ticks do not allocate them
+	static std::vector<flatbuffers::Offset<FlatBuffGenerated::Mob>> mobs;
+	static std::vector<flatbuffers::Offset<FlatBuffGenerated::Indicator>> indicators;
+	static std::vector<flatbuffers::Offset<FlatBuffGenerated::InkParticle>> inkParticles;
+	static std::vector<flatbuffers::Offset<FlatBuffGenerated::MobManipulator>> manipulators;
+	mobs.clear();
+	indicators.clear();
+	inkParticles.clear();
+	manipulators.clear();
+	// bytes per field, measured as the growth of the builder while the field is serialized
+	size_t fieldBytes[(size_t) WorldStateField::MAX] = {};
+	auto measure = [&](WorldStateField field, auto&& serialize) {
+		auto before = builder.GetSize();
+		auto ret = serialize();
+		fieldBytes[(size_t) field] += builder.GetSize() - before;
+		return ret;
+	};
 	for (auto &p : gameState.civilians)
 	{
 		auto &c = p.second;
 		if (!playerSeeCollideable(player, *c))
 			continue;
-		auto mob = createFBMob(builder, player, c.get());
+		auto mob = measure(WorldStateField::MOBS, [&]{ return createFBMob(builder, player, c.get()); });
 		mobs.push_back(mob);
 	}
 	for (auto &pIt : gameState.players)
@@ -234,12 +307,12 @@ flatbuffers::Offset<void> makeWorldState(Player &player, flatbuffers::FlatBuffer
 		if (differentPlayer)
 		{
 			canSeeOther = playerSeeCollideable(player, *p);
-			auto indicator = makePlayerIndicator(builder, player, *p);
+			auto indicator = measure(WorldStateField::INDICATORS, [&]{ return makePlayerIndicator(builder, player, *p); });
 			indicators.push_back(indicator);
 		}
 		if (differentPlayer && !canSeeOther)
 			continue;
-		auto mob = createFBMob(builder, player, p.get());
+		auto mob = measure(WorldStateField::MOBS, [&]{ return createFBMob(builder, player, p.get()); });
 		mobs.push_back(mob);
 	}
 	std::string hspotname = ""; // name of the hidingspot that the player is in
@@ -250,37 +323,39 @@ flatbuffers::Offset<void> makeWorldState(Player &player, flatbuffers::FlatBuffer
 			break;
 		}
 	}
-	auto mobsOffset = builder.CreateVector(mobs);
-	auto indicatorsOffset = builder.CreateVector(indicators);
-	auto hidingspot = builder.CreateString(hspotname);
+	auto mobsOffset = measure(WorldStateField::MOBS, [&]{ return builder.CreateVector(mobs); });
+	auto indicatorsOffset = measure(WorldStateField::INDICATORS, [&]{ return builder.CreateVector(indicators); });
+	auto hidingspot = measure(WorldStateField::HIDING_SPOT, [&]{ return builder.CreateString(hspotname); });
 
-	std::vector<flatbuffers::Offset<FlatBuffGenerated::InkParticle>> inkParticles;
-	std::vector<FlatBuffGenerated::Vec2> inkVecs;
-	for (auto& inkIt : gameState.inkParticles) {
-		auto &ink = inkIt.second;
-		if (!playerSeeCollideable(player, *ink))
+	for (size_t i = 0; i < ink::particles.size(); i++) {
+		if (!playerSeeInk(player, i))
 			continue;
-		auto movableComponent = ink->fbMovable();
-		auto inkOffset = FlatBuffGenerated::CreateInkParticle(builder, movableComponent.get());
+		FlatBuffGenerated::MovableComponent movableComponent(
+			FlatBuffGenerated::Vec2(ink::particles.x[i], ink::particles.y[i]), ink::particles.movableID[i], 0);
+		auto inkOffset = measure(WorldStateField::INK_PARTICLES,
+			[&]{ return FlatBuffGenerated::CreateInkParticle(builder, &movableComponent); });
 		inkParticles.push_back(inkOffset);
 	}
 
-	auto inkParticlesOffset = builder.CreateVector(inkParticles);
+	auto inkParticlesOffset = measure(WorldStateField::INK_PARTICLES, [&]{ return builder.CreateVector(inkParticles); });
 
-	std::vector<flatbuffers::Offset<FlatBuffGenerated::MobManipulator>> manipulators;
 	for (auto &manipulatorIt : gameState.mobManipulators) {
 		auto &manipulator = manipulatorIt.second;
-		if (!mobSeePoint(player, f2b(manipulator->pos), true))
+		if (!pointSeePoint(playerViewPosition(player), f2b(manipulator->pos), true))
 			continue;
 		auto movableComponent = manipulator->fbMovable();
-		auto manOffset = FlatBuffGenerated::CreateMobManipulator(builder,
-			movableComponent.get(), manipulator->type);
+		auto manOffset = measure(WorldStateField::MOB_MANIPULATORS, [&]{ return FlatBuffGenerated::CreateMobManipulator(builder,
+			movableComponent.get(), manipulator->type); });
 		manipulators.push_back(manOffset);
 	}
 
-	auto manipulatorsOffset = builder.CreateVector(manipulators);
+	auto manipulatorsOffset = measure(WorldStateField::MOB_MANIPULATORS, [&]{ return builder.CreateVector(manipulators); });
 
-	auto worldState = FlatBuffGenerated::CreateWorldState(builder, mobsOffset, indicatorsOffset, inkParticlesOffset, framesRemaining, manipulatorsOffset, hidingspot);
+	auto worldState = measure(WorldStateField::OTHER, [&]{ return FlatBuffGenerated::CreateWorldState(builder, mobsOffset,
+		indicatorsOffset, inkParticlesOffset, framesRemaining, manipulatorsOffset, hidingspot); });
+
+	for (size_t f = 0; f < (size_t) WorldStateField::MAX; f++)
+		accountWorldStateField(player.wsHandle, (WorldStateField) f, fieldBytes[f]);
 
 	return worldState.Union();
 }
@@ -289,8 +364,8 @@ class TestContactListener : public b2ContactListener
 {
 	void BeginContact(b2Contact *contact) override
 	{
-		auto collideableA = (Collideable *)contact->GetFixtureA()->GetBody()->GetUserData();
-		auto collideableB = (Collideable *)contact->GetFixtureB()->GetBody()->GetUserData();
+		auto collideableA = collideableOf(contact->GetFixtureA());
+		auto collideableB = collideableOf(contact->GetFixtureB());
 
 		if (collideableA && !collideableA->toBeDeleted &&
 			collideableB && !collideableB->toBeDeleted)
@@ -302,8 +377,8 @@ class TestContactListener : public b2ContactListener
 
 	void EndContact(b2Contact *contact) override
 	{
-		auto collideableA = (Collideable *)contact->GetFixtureA()->GetBody()->GetUserData();
-		auto collideableB = (Collideable *)contact->GetFixtureB()->GetBody()->GetUserData();
+		auto collideableA = collideableOf(contact->GetFixtureA());
+		auto collideableB = collideableOf(contact->GetFixtureB());
 
 		if (collideableA && !collideableA->toBeDeleted &&
 			collideableB && !collideableB->toBeDeleted)
@@ -334,65 +409,139 @@ void physicsInitMob(Mob *m, glm::vec2 pos, float angle, float radius, uint16 cat
 	m->body->SetUserData(m);
 }
 
-std::vector<int> civiliansSpeciesCount()
+void reuseBody(b2Body* body, const b2Vec2& position, float angle)
+{
+	body->SetTransform(position, angle);
+	body->SetLinearVelocity({0, 0});
+	body->SetAngularVelocity(0);
+	body->SetActive(true);
+	body->SetAwake(true);
+}
+
+// gives the civilians left over from the previous match the species of the current players
+void respeciesCivilians()
 {
-	std::vector<int> ret;
-	ret.resize(gameState.players.size());
+	if (gameState.players.empty())
+		return;
+	size_t i = 0;
 	for (auto &p : gameState.civilians)
 	{
 		auto &c = p.second;
 		if (c->species != GOLDFISH_SPECIES)
-			ret[c->species]++;
+			c->species = i++ % gameState.players.size();
 	}
-	return ret;
+	gameState.civilianSpeciesCounts.clear();
+	for (auto &p : gameState.civilians)
+		countCivilianSpecies(p.second->species, 1);
 }
 
-void spawnCivilian(std::string spawnName, NavPoint* spawn) {
-	auto c = std::make_unique<Civilian>();
+void countCivilianSpecies(uint16_t species, int delta)
+{
+	if (species == GOLDFISH_SPECIES)
+		return;
+	auto& counts = gameState.civilianSpeciesCounts;
+	if (species >= counts.size())
+		counts.resize(species + 1);
+	counts[species] += delta;
+}
 
-	int species = 0;
+// the species of a player in the match with the fewest civilians
+static uint16_t scarcestSpecies()
+{
+	auto& counts = gameState.civilianSpeciesCounts;
+	uint16_t species = 0;
+	uint32_t lowest = UINT32_MAX;
+	for (auto &p : gameState.players) {
+		uint16_t s = p.second->species;
+		uint32_t count = s < counts.size() ? counts[s] : 0;
+		if (count < lowest || (count == lowest && s < species)) {
+			species = s;
+			lowest = count;
+		}
+	}
+	return species;
+}
 
-	float goldfishBet = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+void spawnCivilian(const std::string& spawnName, NavPoint* spawn) {
+	auto c = gameState.civilianPool.acquire();
+	if (c) {
+		c->recycle();
+		reuseBody(c->body, g2b(spawn->position), 0);
+	} else {
+		c = std::make_unique<Civilian>();
+		physicsInitMob(c.get(), spawn->position, 0, 0.3f);
+	}
+
+	uint16_t species;
+	float goldfishBet = gameState.randFloat();
 	if (goldfishBet < GOLDFISH_CHANCE)
 		species = GOLDFISH_SPECIES;
-	else {
-		// find species with lowest count of civilians
-		auto civCounts = civiliansSpeciesCount();
-		int lowestSpecies = 0;
-		int lowestSpeciesCount = INT_MAX;
-		for (size_t i = 0; i < civCounts.size(); i++)
-		{
-			if (civCounts[i] < lowestSpeciesCount)
-			{
-				lowestSpecies = i;
-				lowestSpeciesCount = civCounts[i];
-			}
-		}
-		species = lowestSpecies;
-	}
+	else
+		species = scarcestSpecies();
 
 	c->movableID = newMovableID();
 	c->species = species;
 	c->previousNavpoint = spawnName;
 	c->currentNavpoint = spawnName;
-	physicsInitMob(c.get(), spawn->position, 0, 0.3f);
-	c->setNextNavpoint();
+	auto rng = gameState.mobRandom(c->movableID);
+	c->setNextNavpoint(rng);
+	countCivilianSpecies(species, 1);
 	gameState.civilians[c->movableID] = std::move(c);
-	std::cout << "spawning civilian of species " << species <<
-		" at " << spawnName << " to a total of " << gameState.civilians.size() << "\n";
+	LOG_DEBUG("spawning civilian of species %d at %s to a total of %zu", species, spawnName.c_str(),
+		gameState.civilians.size());
 }
 
-void spawnCivilians()
+static bool anyPlayerSeesPoint(const b2Vec2& point)
 {
-	// spawn on all spawnpoints
-	std::vector<std::string> spawns;
-	for (auto &p : gameState.level->navpoints)
-	{
-		if (p.second->isspawn)
-		{
-			spawnCivilian(p.first, p.second.get());
+	for (auto &p : gameState.players) {
+		if (pointSeePoint(playerViewPosition(*p.second), point, true))
+			return true;
+	}
+	return false;
+}
+
+// the next civilian spawn in round robin order that no player sees, or just the next one if
+// the players see them all, so that civilians don't pop up in front of anyone
+static size_t pickCivilianSpawn()
+{
+	auto& spawns = gameState.level->civilianSpawns;
+	size_t first = gameState.nextCivilianSpawn % spawns.size();
+	size_t picked = first;
+	for (size_t i = 0; i < spawns.size(); i++) {
+		size_t candidate = (first + i) % spawns.size();
+		if (!anyPlayerSeesPoint(g2b(spawns[candidate].second->position))) {
+			picked = candidate;
+			break;
 		}
 	}
+	gameState.nextCivilianSpawn = picked + 1;
+	return picked;
+}
+
+// every CIVILIAN_TIME ticks one civilian per spawn becomes due, the scheduler then places at most
+// CIVILIAN_SPAWNS_PER_TICK of them a tick instead of creating all the bodies at once
+static void scheduleCivilianSpawns()
+{
+	auto& civilianTimer = gameState.civilianTimer;
+	uint32_t maxCivilians = gameState.options["maxcivilians"].as<uint32_t>();
+	uint32_t room = maxCivilians > gameState.civilians.size() ? maxCivilians - gameState.civilians.size() : 0;
+	if (civilianTimer == 0 && room > 0) {
+		gameState.pendingCivilianSpawns = std::min<uint32_t>(
+			gameState.pendingCivilianSpawns + gameState.level->civilianSpawns.size(), room);
+		civilianTimer = CIVILIAN_TIME;
+	}
+	else
+		civilianTimer = std::max(0, civilianTimer - 1);
+
+	gameState.pendingCivilianSpawns = std::min(gameState.pendingCivilianSpawns, room);
+	if (gameState.pendingCivilianSpawns == 0)
+		return;
+	TRACE_SCOPE("spawnCivilians");
+	for (uint32_t i = 0; i < CIVILIAN_SPAWNS_PER_TICK && gameState.pendingCivilianSpawns > 0; i++) {
+		auto& spawn = gameState.level->civilianSpawns[pickCivilianSpawn()];
+		spawnCivilian(spawn.first, spawn.second);
+		gameState.pendingCivilianSpawns--;
+	}
 }
 
 void spawnPlayer(Player &player)
@@ -429,7 +578,7 @@ void spawnPlayer(Player &player)
 	physicsInitMob(&player, spawn->position, 0, 0.3f, 3);
 	player.targetPosition = spawn->position;
 
-	std::cout << "spawned player at " << maxSpawn << ", " << player.body->GetPosition() << "\n";
+	LOG_INFO("spawned player at %s, (%f, %f)", maxSpawn.c_str(), player.body->GetPosition().x, player.body->GetPosition().y);
 }
 
 Mob *findMobById(uint16_t id)
@@ -451,7 +600,7 @@ Mob *findMobById(uint16_t id)
 
 void executeCommandKill(Player &player, uint16_t id)
 {
-	if (player.bombsAffecting > 0)
+	if (player.isDead() || player.bombsAffecting > 0)
 		return;
 	player.lastAttack = std::chrono::system_clock::now();
 	auto m = findMobById(id);
@@ -488,15 +637,61 @@ void sendHighscores()
 	sendToAll(data);
 }
 
+void sendInitMetadata(Player &targetPlayer)
+{
+	flatbuffers::FlatBufferBuilder builder(1);
+	std::vector<flatbuffers::Offset<FlatBuffGenerated::InitPlayer>> playerOffsets;
+	iterateOverMovableMap(gameState.players,
+		[&](Player& player){
+			auto name = builder.CreateString(player.name.c_str());
+			auto playerOffset = FlatBuffGenerated::CreateInitPlayer(builder, player.playerID, name, player.species, player.ready);
+			playerOffsets.push_back(playerOffset);
+		}
+	);
+	auto players = builder.CreateVector(playerOffsets);
+	auto metadata = FlatBuffGenerated::CreateInitMetadata(builder, players, targetPlayer.movableID, targetPlayer.playerID,
+		targetPlayer.sessionToken);
+	sendServerMessage(targetPlayer, builder, FlatBuffGenerated::ServerMessageUnion_InitMetadata, metadata.Union());
+}
+
+std::string makeLevelAnnounce()
+{
+	flatbuffers::FlatBufferBuilder builder;
+	auto announce = FlatBuffGenerated::CreateLevelAnnounce(builder, gameState.level->file->levelHash);
+	return makeServerMessage(builder, FlatBuffGenerated::ServerMessageUnion_LevelAnnounce, announce.Union());
+}
+
+// binds a new connection to a player of a match that was restored from a checkpoint
+void rejoinPlayer(dfws::Handle hdl, uint64_t sessionToken)
+{
+	Player* player = nullptr;
+	iterateOverMovableMap(gameState.players,
+		[&](Player& p){
+			if (sessionToken != 0 && p.sessionToken == sessionToken && p.wsHandle == dfws::INVALID_HANDLE)
+				player = &p;
+		}
+	);
+	if (!player) {
+		sendGameAlreadyInProgress(hdl);
+		return;
+	}
+	player->wsHandle = hdl;
+	player->levelSent = false;
+	LOG_INFO("player %s rejoined", player->name.c_str());
+	sendInitMetadata(*player);
+	// the skill bar and the highscores follow the LevelCacheStatus, the lobby would drop them
+	dfws::SendData(hdl, makeLevelAnnounce());
+}
+
 void executeSkill(Player& p, uint8_t skillPos, b2Vec2 mousePos) {
 	if (skillPos >= p.skills.size()) {
-		std::cout << "skillPos out of bounds\n";
+		LOG_WARN("skillPos out of bounds");
 		return;
 	}
 	Skills skill = (Skills) p.skills[skillPos];
 	auto skillHandler = skillHandlers[(uint16_t) skill];
 	if (skillHandler == nullptr) {
-		std::cout << "no such skill handler " << (uint16_t) skill << "\n";
+		LOG_WARN("no such skill handler %d", (uint16_t) skill);
 	}
 	bool used = skillHandler(p, skill, mousePos);
 	if (used) {
@@ -505,17 +700,10 @@ void executeSkill(Player& p, uint8_t skillPos, b2Vec2 mousePos) {
 	}
 }
 
-void gameOnMessage(dfws::Handle hdl, const std::string& payload)
+// applies a command of a player to the match, shared by the live game and the journal replay
+void applyClientCommand(Player& p, const FlatBuffGenerated::ClientMessage* clientMessage, uint64_t received)
 {
-	const auto clientMessage = flatbuffers::GetRoot<FlatBuffGenerated::ClientMessage>(payload.c_str());
-	const auto guard = gameState.lock();
-
-	auto p = getPlayerByConnHdl(hdl);
-	if (!p) {
-		sendGameAlreadyInProgress(hdl);
-		return;
-	}
-	if (p->state == MobState::ATTACKING)
+	if (p.state == MobState::ATTACKING)
 		return;
 
 	switch (clientMessage->event_type())
@@ -523,55 +711,108 @@ void gameOnMessage(dfws::Handle hdl, const std::string& payload)
 	case FlatBuffGenerated::ClientMessageUnion::ClientMessageUnion_CommandMove:
 	{
 		const auto event = clientMessage->event_as_CommandMove();
-		p->targetPosition = glm::vec2(event->target()->x(), event->target()->y());
-		p->state = p->state == MobState::RUNNING ? MobState::RUNNING : MobState::WALKING;
-		p->killTargetID = 0;
-		p->lastAttack = std::chrono::system_clock::from_time_t(0);
+		commandReceived(p, received);
+		p.targetPosition = glm::vec2(event->target()->x(), event->target()->y());
+		p.state = p.state == MobState::RUNNING ? MobState::RUNNING : MobState::WALKING;
+		p.killTargetID = 0;
+		p.lastAttack = std::chrono::system_clock::from_time_t(0);
 	}
 	break;
 	case FlatBuffGenerated::ClientMessageUnion::ClientMessageUnion_CommandRun:
 	{
 		const auto event = clientMessage->event_as_CommandRun();
-		p->state = event->run() ? MobState::RUNNING : MobState::WALKING;
+		p.state = event->run() ? MobState::RUNNING : MobState::WALKING;
 	}
 	break;
 	case FlatBuffGenerated::ClientMessageUnion::ClientMessageUnion_CommandKill:
 	{
 		const auto event = clientMessage->event_as_CommandKill();
-		executeCommandKill(*p, event->mobID());
+		commandReceived(p, received);
+		executeCommandKill(p, event->mobID());
 	}
 	break;
 	case FlatBuffGenerated::ClientMessageUnion::ClientMessageUnion_CommandSkill:
 	{
 		const auto event = clientMessage->event_as_CommandSkill();
-		executeSkill(*p, event->skill(), {event->mousePos()->x(), event->mousePos()->y()});
+		executeSkill(p, event->skill(), {event->mousePos()->x(), event->mousePos()->y()});
 	}
 	break;
 
 	default:
-		std::cout << "gameOnMessage: some other message type received\n";
+		LOG_WARN("gameOnMessage: some other message type received");
 		break;
 	}
 }
 
-void initGameThread(TestContactListener& tcl)
+void gameOnMessage(dfws::Handle hdl, const std::string& payload)
 {
-	flatbuffers::FlatBufferBuilder builder(1);
+	const auto clientMessage = flatbuffers::GetRoot<FlatBuffGenerated::ClientMessage>(payload.c_str());
+	// read before the lock, waiting for the game thread is part of the command latency
+	const auto received = latencyClock();
+	metrics::lockQueueDepth.add(1);
 	const auto guard = gameState.lock();
+	metrics::lockQueueDepth.add(-1);
 
-	// init physics
-	gameState.b2world = std::make_unique<b2World>(b2Vec2(0, 0));
-	gameState.b2world->SetContactListener(&tcl);
+	if (clientMessage->event_type() == FlatBuffGenerated::ClientMessageUnion_JoinRequest) {
+		rejoinPlayer(hdl, clientMessage->event_as_JoinRequest()->sessionToken());
+		return;
+	}
+
+	auto p = getPlayerByConnHdl(hdl);
+	if (!p) {
+		sendGameAlreadyInProgress(hdl);
+		return;
+	}
+	if (clientMessage->event_type() == FlatBuffGenerated::ClientMessageUnion_LevelCacheStatus) {
+		const auto event = clientMessage->event_as_LevelCacheStatus();
+		auto& file = *gameState.level->file;
+		if ((!event->hit() || event->hash() != file.levelHash) && !p->levelSent) {
+			dfws::SendData(p->wsHandle, file.clientMessage());
+			p->levelSent = true;
+		}
+		// any level went out first, the client reads these in its gameplay state. A rejoining player
+		// gets back the skills the match kept for them
+		p->sendSkillBarUpdate();
+		sendHighscores();
+		return;
+	}
+	if (clientMessage->event_type() == FlatBuffGenerated::ClientMessageUnion_Pong) {
+		handlePong(*p, clientMessage->event_as_Pong());
+		return;
+	}
+	journalCommand(*p, payload);
+	applyClientCommand(*p, clientMessage, received);
+}
 
-	// load level
-	gameState.level = std::make_unique<Level>();
-	auto path = gameState.options["level"].as<std::string>();
-	loadLevel(path);
+// returns true if the world is new and has to be presimulated, expects the game lock to be held
+// when clients are connected
+bool initGameThread(TestContactListener& tcl)
+{
+	// a recycled match keeps the world, the level bodies and the civilians of the previous one
+	bool freshWorld = !gameState.b2world;
+	if (freshWorld)
+	{
+		// init physics
+		gameState.b2world = std::make_unique<b2World>(b2Vec2(0, 0));
+		gameState.rng.seed(gameState.seed);
+		gameState.tick = 0;
+
+		// load level
+		gameState.level = std::make_unique<Level>();
+		auto path = gameState.options["level"].as<std::string>();
+		loadLevel(path);
+	}
+	else
+	{
+		respeciesCivilians();
+	}
+	gameState.b2world->SetContactListener(&tcl);
+	gameState.roundTimer = ROUND_LENGTH;
+	gameState.civilianTimer = 0;
+	gameState.pendingCivilianSpawns = 0;
 
-	// send level to clients
-	auto levelOffset = serializeLevel(builder);
-	auto data = makeServerMessage(builder, FlatBuffGenerated::ServerMessageUnion_Level, levelOffset.Union());
-	sendToAll(data);
+	// announce the level to clients, the ones that don't have it cached ask for it
+	sendToAll(makeLevelAnnounce());
 
 	uint8_t lastSpecies = 0;
 	iterateOverMovableMap(gameState.players,
@@ -581,6 +822,19 @@ void initGameThread(TestContactListener& tcl)
 			spawnPlayer(p);
 		}
 	);
+	return freshWorld;
+}
+
+// clears everything that belongs to the finished match but keeps the world, the level and the civilians
+void recycleMatch()
+{
+	ink::clear();
+	gameState.mobManipulators.clear();
+	gameState.players.clear();
+	for (auto &hspot : gameState.level->hidingspots)
+		hspot->playersInside.clear();
+	for (auto &p : gameState.civilians)
+		p.second->bombsAffecting = 0;
 }
 
 template<typename T>
@@ -595,45 +849,172 @@ void updateCollideableMoveableMap(MovableMap<T>& m)
 	}
 }
 
-void gameThreadTick(int& civilianTimer)
+// the civilians decide in parallel on the workers, then apply their decisions one after another
+// in map order so the world changes the same way whatever the number of workers
+static void updateCivilians()
+{
+	static std::vector<Civilian*> civilians;
+	civilians.clear();
+	for (auto& c : gameState.civilians)
+		civilians.push_back(c.second.get());
+	workers::parallelFor(civilians.size(), [](size_t begin, size_t end){
+		for (size_t i = begin; i < end; i++)
+			civilians[i]->decide();
+	});
+	for (auto it = gameState.civilians.cbegin(); it != gameState.civilians.cend();) {
+		it->second->apply();
+		if (it->second->toBeDeleted) {
+			countCivilianSpecies(it->second->species, -1);
+			gameState.civilianPool.release(std::move(it->second));
+			it = gameState.civilians.erase(it);
+		} else
+			++it;
+	}
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+const uint32_t LOAD_WINDOW_TICKS = 10 * SECOND;
+
+// rolling cpu usage and p99 tick time of the game thread over the last LOAD_WINDOW_TICKS ticks
+static void updateTickLoad(double tickSeconds)
+{
+	static std::array<float, LOAD_WINDOW_TICKS> window;
+	static uint32_t ticks = 0;
+	static timespec cpuStart, wallStart;
+	if (ticks == 0) {
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuStart);
+		clock_gettime(CLOCK_MONOTONIC, &wallStart);
+	}
+	window[ticks++] = tickSeconds;
+	if (ticks < LOAD_WINDOW_TICKS)
+		return;
+	ticks = 0;
+
+	timespec cpuEnd, wallEnd;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+	clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+	auto seconds = [](const timespec& from, const timespec& to){
+		return (to.tv_sec - from.tv_sec) + (to.tv_nsec - from.tv_nsec) / 1e9;
+	};
+	double cpu = seconds(cpuStart, cpuEnd) / seconds(wallStart, wallEnd);
+	auto p99 = window.begin() + LOAD_WINDOW_TICKS * 99 / 100;
+	std::nth_element(window.begin(), p99, window.end());
+	agones::SetTickLoad(cpu, *p99 * 1000);
+}
+
+static void updateTickMetrics()
+{
+	static uint64_t lastRaycasts = 0;
+	auto raycasts = metrics::raycasts.get();
+	metrics::raycastsPerTick.observe(raycasts - lastRaycasts);
+	lastRaycasts = raycasts;
+
+	metrics::players.set(gameState.players.size());
+	metrics::civilians.set(gameState.civilians.size());
+	size_t onRails = 0;
+	for (auto& c : gameState.civilians)
+		onRails += c.second->onRails;
+	metrics::civiliansOnRails.set(onRails);
+	metrics::inkParticles.set(ink::particles.size());
+	metrics::mobManipulators.set(gameState.mobManipulators.size());
+}
+
+void gameThreadTick()
 {
 	// update physics
-	gameState.b2world->Step(1 / 20.0, 8, 3);
+	{
+		trace::Scope stepScope("b2World::Step");
+		ALLOC_PHASE("b2World::Step");
+		auto stepStart = std::chrono::steady_clock::now();
+		gameState.b2world->Step(1 / 20.0, 8, 3);
+		metrics::physicsStepSeconds.observe(secondsSince(stepStart));
+		if (trace::enabled)
+			trace::recordStepProfile(stepScope.begin);
+	}
 
-	updateCollideableMoveableMap(gameState.inkParticles);
-	updateCollideableMoveableMap(gameState.civilians);
-	updateCollideableMoveableMap(gameState.mobManipulators);
+	{
+		TRACE_SCOPE("update ink");
+		ink::update();
+		ink::applyToMobs();
+	}
+	{
+		TRACE_SCOPE("update civilians");
+		updateCivilians();
+	}
+	{
+		TRACE_SCOPE("update mobManipulators");
+		updateCollideableMoveableMap(gameState.mobManipulators);
+	}
 
 	// in players the toBeDeleted variable doesn't actually mean that the player is to be deleted
 	// so we have to treat this differently
-	iterateOverMovableMap(gameState.players,
-		[&](Player& p){
-			p.update();
-		}
-	);
+	{
+		TRACE_SCOPE("update players");
+		iterateOverMovableMap(gameState.players,
+			[&](Player& p){
+				p.update();
+			}
+		);
+	}
+	{
+		TRACE_SCOPE("steering");
+		steering::steerQueued();
+	}
 
 	// spawn civilians if need be
-	if (!gameState.options["ghosttown"].as<bool>() && civilianTimer == 0 && gameState.civilians.size() < MAX_CIVILIANS)
+	if (!gameState.options["ghosttown"].as<bool>() && !gameState.level->civilianSpawns.empty())
+		scheduleCivilianSpawns();
+
+	// all bodies removed during the tick leave the world together
 	{
-		spawnCivilians();
-		civilianTimer = CIVILIAN_TIME;
+		TRACE_SCOPE("park released bodies");
+		gameState.civilianPool.parkReleased();
 	}
-	else
-		civilianTimer = std::max(0, civilianTimer - 1);
+
+	gameState.tick++;
+	journalChecksum();
+}
+
+// lets the civilians spread over the map before the players see it
+static void presimulate()
+{
+	auto presimulationStart = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < PRESIMULATE_TICKS; i++) {
+		gameThreadTick();
+	}
+	metrics::presimulationSeconds.observe(secondsSince(presimulationStart));
 }
 
-void gameThread()
+void gameThread(bool restored)
 {
 	TestContactListener tcl;
 	flatbuffers::FlatBufferBuilder builder(1);
 
-	int civilianTimer = 0;
-	uint64_t roundTimer = ROUND_LENGTH;
+	if (restored) {
+		// the world was rebuilt from a checkpoint, just pick it up where it was left
+		const auto guard = gameState.lock();
+		gameState.b2world->SetContactListener(&tcl);
+	} else {
+		// commands must not land between spawning the players, the journal start and the
+		// presimulation ticks or the journal could not replay them
+		const auto guard = gameState.lock();
+		if (initGameThread(tcl)) {
+			journalStart();
+			presimulate();
+		}
+	}
+
+	auto& roundTimer = gameState.roundTimer;
 
-	initGameThread(tcl);
+	bool rematch = gameState.options["rematch"].as<bool>();
 
-	for (uint32_t i = 0; i < PRESIMULATE_TICKS; i++) {
-		gameThreadTick(civilianTimer);
+	{
+		const auto guard = gameState.lock();
+		recordingStart();
 	}
 
 	// game loop
@@ -641,31 +1022,70 @@ void gameThread()
 	{
 		auto maybe_guard = gameState.lock();
 		auto frameStart = std::chrono::system_clock::now();
+		auto tickStart = std::chrono::steady_clock::now();
+		uint64_t tickTraceStart = trace::enabled ? trace::now() : 0;
 
 		roundTimer--;
-		if (roundTimer == 0)
+		if (roundTimer == 0 || (rematch && gameState.players.empty()))
 		{
 			// send game end message to everyone
 			builder.Clear();
 			auto ev = FlatBuffGenerated::CreateSimpleServerEvent(builder, FlatBuffGenerated::SimpleServerEventType_GameEnded);
 			auto data = makeServerMessage(builder, FlatBuffGenerated::ServerMessageUnion_SimpleServerEvent, ev.Union());
 			sendToAll(data);
+			logBandwidthSummary();
+			logLatencySummary();
+			journalEnd();
+			recordingEnd();
+			if (rematch) {
+				// returnToLobby closes the connections, the clients join the next match by connecting again
+				recycleMatch();
+				dfws::Post(&returnToLobby);
+				return;
+			}
 			// FIXME: Proper closing of all connections, so that this sleep is unnecessary
 			std::this_thread::sleep_for(std::chrono::milliseconds(500));
 			agones::Shutdown();
 			return;
 		}
 
-		gameThreadTick(civilianTimer);
+		if (checkpointRequested()) {
+			// the match moves to another process, the players reconnect there with their session tokens
+			writeCheckpoint(gameState.options["checkpoint"].as<std::string>());
+			journalEnd();
+			recordingEnd();
+			agones::Shutdown();
+			return;
+		}
+
+		gameThreadTick();
+		commandsApplied();
+		recordFrame();
 
 		// send data to everyone
 		iterateOverMovableMap(gameState.players,
 			[&](Player& p){
 				builder.Clear();
-				auto offset = makeWorldState(p, builder, roundTimer);
+				flatbuffers::Offset<void> offset;
+				{
+					TRACE_SCOPE("makeWorldState");
+					offset = makeWorldState(p, builder, roundTimer);
+				}
+				TRACE_SCOPE("send WorldState");
 				sendServerMessage(p, builder, FlatBuffGenerated::ServerMessageUnion_WorldState, offset);
+				snapshotSent(p);
 			}
 		);
+		sendPings();
+
+		auto tickSeconds = secondsSince(tickStart);
+		metrics::tickSeconds.observe(tickSeconds);
+		updateTickLoad(tickSeconds);
+		updateTickMetrics();
+		if (trace::enabled) {
+			trace::record("tick", tickTraceStart, trace::now() - tickTraceStart);
+			trace::endTick();
+		}
 
 		// Drop the lock
 		maybe_guard.reset();
@@ -674,3 +1094,196 @@ void gameThread()
 		std::this_thread::sleep_until(frameStart + std::chrono::milliseconds(FRAME_TIME));
 	}
 }
+
+const uint32_t BENCH_WARMUP_TICKS = 20;
+const uint32_t BENCH_BOTS = 4;
+
+// sends every living bot to a random navpoint
+static void moveBots()
+{
+	auto& navpoints = gameState.level->navpoints;
+	iterateOverMovableMap(gameState.players,
+		[&](Player& p){
+			if (p.isDead() || navpoints.empty())
+				return;
+			auto it = navpoints.begin();
+			std::advance(it, gameState.randInt(navpoints.size()));
+			p.targetPosition = it->second->position;
+			p.state = MobState::WALKING;
+		}
+	);
+}
+
+int runBench(uint32_t ticks)
+{
+	TestContactListener tcl;
+	flatbuffers::FlatBufferBuilder builder(1);
+
+	// bots are players without a connection, everything sent to them is dropped
+	uint32_t bots = gameState.options.count("numplayers") ? gameState.options["numplayers"].as<unsigned long>() : BENCH_BOTS;
+	for (uint32_t i = 0; i < bots; i++) {
+		auto p = std::make_unique<Player>();
+		p->movableID = newMovableID();
+		p->name = "bot" + std::to_string(i);
+		p->playerID = i;
+		p->ready = true;
+		gameState.players[p->movableID] = std::move(p);
+	}
+	if (initGameThread(tcl))
+		presimulate();
+
+	int64_t budget = gameState.options.count("allocbudget") ? gameState.options["allocbudget"].as<int64_t>() : -1;
+	std::vector<double> tickTimes;
+	tickTimes.reserve(ticks);
+	uint64_t steadyAllocations = 0;
+	uint64_t maxAllocations = 0;
+	uint32_t ticksOverBudget = 0;
+	// hash of every WorldState built for the bots, the visibility polygon must not change what they see
+	uint64_t worldStatesHash = contentHash(nullptr, 0);
+
+	// with --recorddir the bench records too, verifyRecording reads it back
+	recordingStart();
+	alloctrack::trackThisThread(true);
+	for (uint32_t t = 0; t < ticks; t++) {
+		auto tickStart = std::chrono::steady_clock::now();
+		if (t % SECOND == 0)
+			moveBots();
+		gameThreadTick();
+		recordFrame();
+		iterateOverMovableMap(gameState.players,
+			[&](Player& p){
+				TRACE_SCOPE("makeWorldState");
+				builder.Clear();
+				makeWorldState(p, builder, gameState.roundTimer);
+				worldStatesHash = contentHash(builder.GetCurrentBufferPointer(), builder.GetSize(), worldStatesHash);
+			}
+		);
+		tickTimes.push_back(secondsSince(tickStart));
+
+		auto allocations = alloctrack::takeCount();
+		if (t < BENCH_WARMUP_TICKS)
+			continue;
+		steadyAllocations += allocations;
+		maxAllocations = std::max(maxAllocations, allocations);
+		if (budget >= 0 && allocations > (uint64_t) budget)
+			ticksOverBudget++;
+	}
+	alloctrack::trackThisThread(false);
+	if (gameState.options.count("recorddir")) {
+		recordingEnd();
+		std::cout << "recorded up to tick " << gameState.tick << " mobs checksum " << recordedMobsChecksum() << "\n";
+	}
+
+	std::sort(tickTimes.begin(), tickTimes.end());
+	std::cout << "bench: " << ticks << " ticks, " << bots << " bots, " << gameState.civilians.size() << " civilians\n";
+	std::cout << "tick time median " << tickTimes[tickTimes.size() / 2] * 1000 << "ms p99 "
+		<< tickTimes[tickTimes.size() * 99 / 100] * 1000 << "ms max " << tickTimes.back() * 1000 << "ms\n";
+	std::cout << "civilians stuck " << metrics::civilianStuck.get() << ", forced despawns " << metrics::civilianForcedDespawns.get()
+		<< ", resolution raycasts " << metrics::resolutionRaycasts.get() << ", avoidance adjustments " << metrics::avoidanceAdjustments.get() << "\n";
+	std::cout << "world states checksum " << worldStatesHash << ", visibility polygons " << metrics::visibilityPolygons.get()
+		<< ", visibility culled " << metrics::visibilityCulled.get() << "\n";
+	if (!alloctrack::compiled)
+		return 0;
+
+	uint32_t steadyTicks = ticks > BENCH_WARMUP_TICKS ? ticks - BENCH_WARMUP_TICKS : 0;
+	std::cout << "steady state allocations per tick: average "
+		<< (steadyTicks ? (double) steadyAllocations / steadyTicks : 0) << " max " << maxAllocations << "\n";
+	alloctrack::printPhases(std::cout, ticks);
+	if (ticksOverBudget > 0) {
+		std::cout << ticksOverBudget << " ticks allocated more than the budget of " << budget << "\n";
+		return 1;
+	}
+	return 0;
+}
+
+int runReplay(const std::string& path)
+{
+	std::vector<uint8_t> data;
+	std::vector<const FlatBuffGenerated::JournalEntry*> entries;
+	if (!readJournal(path, data, entries))
+		return 1;
+	auto start = entries[0]->event_as_JournalStart();
+
+	auto levelPath = gameState.options["level"].as<std::string>();
+	auto file = getLevelFile(levelPath);
+	if (!file)
+		return 1;
+	if (file->levelHash != start->levelHash()) {
+		std::cout << "journal " << path << " was recorded on a different level than " << levelPath << "\n";
+		return 1;
+	}
+	if (start->ghosttown() != gameState.options["ghosttown"].as<bool>()) {
+		std::cout << "journal " << path << " was recorded with ghosttown " << start->ghosttown() << "\n";
+		return 1;
+	}
+
+	// the players get the ids they had in the match, nothing is sent to them
+	if (start->players()) {
+		for (auto fb_P : *start->players()) {
+			auto p = std::make_unique<Player>();
+			p->movableID = fb_P->movableID();
+			p->playerID = fb_P->playerID();
+			p->name = fb_P->name() ? fb_P->name()->str() : "";
+			p->ready = true;
+			gameState.players[p->movableID] = std::move(p);
+		}
+	}
+	gameState.seed = start->seed();
+	TestContactListener tcl;
+	initGameThread(tcl);
+
+	auto replayStart = std::chrono::steady_clock::now();
+	auto advanceTo = [](uint32_t tick){
+		while (gameState.tick < tick)
+			gameThreadTick();
+	};
+	uint32_t commands = 0, checksums = 0;
+	for (size_t i = 1; i < entries.size(); i++) {
+		auto entry = entries[i];
+		switch (entry->event_type())
+		{
+		case FlatBuffGenerated::JournalEvent_JournalCommand:
+		{
+			auto command = entry->event_as_JournalCommand();
+			advanceTo(command->tick());
+			auto it = gameState.players.find(command->movableID());
+			if (it == gameState.players.end() || !command->message())
+				break;
+			// replayed commands have no arrival to time, they stay out of the latency histograms
+			applyClientCommand(*it->second,
+				flatbuffers::GetRoot<FlatBuffGenerated::ClientMessage>(command->message()->data()), 0);
+			commands++;
+		}
+		break;
+		case FlatBuffGenerated::JournalEvent_JournalLeave:
+		{
+			auto leave = entry->event_as_JournalLeave();
+			advanceTo(leave->tick());
+			gameState.players.erase(leave->movableID());
+		}
+		break;
+		case FlatBuffGenerated::JournalEvent_JournalChecksum:
+		{
+			auto checksum = entry->event_as_JournalChecksum();
+			advanceTo(checksum->tick());
+			if (worldChecksum() != checksum->checksum()) {
+				std::cout << "replay diverged at tick " << checksum->tick() << " after "
+					<< commands << " commands\n";
+				return 1;
+			}
+			checksums++;
+		}
+		break;
+
+		default:
+			std::cout << "unexpected journal entry " << i << "\n";
+			return 1;
+		}
+	}
+
+	auto seconds = secondsSince(replayStart);
+	std::cout << "replay: " << gameState.tick << " ticks, " << commands << " commands, "
+		<< checksums << " checksums matched in " << seconds << "s ("
+		<< (seconds > 0 ? gameState.tick / seconds : 0) << " ticks/s)\n";
+	return 0;
+}
@@ -1,10 +1,19 @@
 #pragma once
 
-void gameThread();
+// restored is true when the match was loaded from a checkpoint instead of started from the lobby
+void gameThread(bool restored);
+// runs ticks headless ticks with bot players as fast as possible, returns the process exit code
+int runBench(uint32_t ticks);
+// reruns a journaled match headless and checks every tick against the recorded checksums
+int runReplay(const std::string& path);
+// received is the latencyClock() reading of the message arriving, 0 leaves the command untimed
+void applyClientCommand(Player& p, const FlatBuffGenerated::ClientMessage* clientMessage, uint64_t received);
 uint16_t newMovableID();
 void gameOnMessage(dfws::Handle hdl, const std::string& msg);
 void spawnPlayer(Player& p);
-void spawnCivilian();
+void spawnCivilian(const std::string& spawnName, NavPoint* spawn);
+// adds delta to the count of the species in gameState.civilianSpeciesCounts
+void countCivilianSpecies(uint16_t species, int delta);
 Player* getPlayerByConnHdl(dfws::Handle hdl);
 void sendServerMessage(Player& player,
 	flatbuffers::FlatBufferBuilder &builder,
@@ -14,9 +23,14 @@ std::string makeServerMessage(flatbuffers::FlatBufferBuilder &builder,
 	FlatBuffGenerated::ServerMessageUnion type,
 	flatbuffers::Offset<void> offset);
 bool playerSeeCollideable(Player &p, Collideable &c);
+bool pointSeePoint(const b2Vec2 &from, const b2Vec2 &to, bool ignoreMobs = false);
 bool mobSeePoint(Mob &m, const b2Vec2 &point, bool ignoreMobs = false);
-void sendToAll(std::string &data);
+b2Vec2 playerViewPosition(Player &p);
+void sendToAll(const std::string &data);
 void sendHighscores();
+void sendInitMetadata(Player &targetPlayer);
 void sendGameAlreadyInProgress(dfws::Handle hdl);
 void physicsInitMob(Mob *m, glm::vec2 pos, float angle, float radius, uint16 categoryBits);
+// puts a parked body of a pooled entity back into the world at rest
+void reuseBody(b2Body* body, const b2Vec2& position, float angle);
 Mob *findMobById(uint16_t id);
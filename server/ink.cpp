@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <cmath>
+
+#include "ink.hpp"
+#include "deadfish.hpp"
+#include "spatial_hash.hpp"
+#include "../common/constants.hpp"
+
+namespace ink {
+
+// what Box2D gives the old body: density 1 and linear damping 1, stepped at the tick rate
+const float MASS = M_PI * RADIUS * RADIUS;
+const float LINEAR_DAMPING = 1;
+const float TIME_STEP = 1.f / SECOND;
+const float OVERLAP_DISTANCE = RADIUS + MOB_RADIUS;
+
+Particles particles;
+
+void launch(const b2Vec2& position, const b2Vec2& impulse, uint16_t movableID)
+{
+	add(position, (1 / MASS) * impulse, movableID, LIFETIME_FRAMES);
+}
+
+void add(const b2Vec2& position, const b2Vec2& velocity, uint16_t movableID, uint16_t lifetimeFrames)
+{
+	particles.movableID.push_back(movableID);
+	particles.x.push_back(position.x);
+	particles.y.push_back(position.y);
+	particles.velocityX.push_back(velocity.x);
+	particles.velocityY.push_back(velocity.y);
+	particles.lifetimeFrames.push_back(lifetimeFrames);
+}
+
+bool contains(uint16_t movableID)
+{
+	return std::find(particles.movableID.begin(), particles.movableID.end(), movableID) != particles.movableID.end();
+}
+
+void clear()
+{
+	particles.movableID.clear();
+	particles.x.clear();
+	particles.y.clear();
+	particles.velocityX.clear();
+	particles.velocityY.clear();
+	particles.lifetimeFrames.clear();
+}
+
+void update()
+{
+	// the damping of b2Island::Solve followed by its position integration
+	const float damping = 1 / (1 + TIME_STEP * LINEAR_DAMPING);
+	size_t kept = 0;
+	for (size_t i = 0; i < particles.size(); i++) {
+		if (--particles.lifetimeFrames[i] == 0)
+			continue;
+		float vx = particles.velocityX[i] * damping;
+		float vy = particles.velocityY[i] * damping;
+		particles.movableID[kept] = particles.movableID[i];
+		particles.velocityX[kept] = vx;
+		particles.velocityY[kept] = vy;
+		particles.x[kept] = particles.x[i] + TIME_STEP * vx;
+		particles.y[kept] = particles.y[i] + TIME_STEP * vy;
+		particles.lifetimeFrames[kept] = particles.lifetimeFrames[i];
+		kept++;
+	}
+	particles.movableID.resize(kept);
+	particles.x.resize(kept);
+	particles.y.resize(kept);
+	particles.velocityX.resize(kept);
+	particles.velocityY.resize(kept);
+	particles.lifetimeFrames.resize(kept);
+}
+
+void applyToMobs()
+{
+	static std::vector<Mob*> mobs;
+	static std::vector<float> mobX, mobY;
+	static SpatialHash grid(OVERLAP_DISTANCE);
+	mobs.clear();
+	mobX.clear();
+	mobY.clear();
+	auto gather = [&](Mob& m) {
+		m.bombsAffecting = 0;
+		// dead players have no body, civilians on rails are out of the world
+		if (!m.body || !m.body->IsActive())
+			return;
+		mobs.push_back(&m);
+		mobX.push_back(m.body->GetPosition().x);
+		mobY.push_back(m.body->GetPosition().y);
+	};
+	for (auto& p : gameState.players)
+		gather(*p.second);
+	for (auto& c : gameState.civilians)
+		gather(*c.second);
+	if (particles.size() == 0)
+		return;
+
+	grid.build(mobX.data(), mobY.data(), mobs.size());
+	for (size_t i = 0; i < particles.size(); i++) {
+		float x = particles.x[i], y = particles.y[i];
+		grid.forNear(x, y, [&](uint32_t m) {
+			float dx = mobX[m] - x, dy = mobY[m] - y;
+			if (dx * dx + dy * dy < OVERLAP_DISTANCE * OVERLAP_DISTANCE)
+				mobs[m]->bombsAffecting++;
+		});
+	}
+}
+
+float firstHit(const b2Vec2& from, const b2Vec2& to)
+{
+	float first = 2;
+	float dx = to.x - from.x, dy = to.y - from.y;
+	float a = dx * dx + dy * dy;
+	if (a == 0)
+		return first;
+	for (size_t i = 0; i < particles.size(); i++) {
+		float px = from.x - particles.x[i], py = from.y - particles.y[i];
+		float c = px * px + py * py - RADIUS * RADIUS;
+		if (c < 0)
+			continue;
+		float b = px * dx + py * dy;
+		if (b >= 0)
+			continue; // heading away
+		float disc = b * b - a * c;
+		if (disc < 0)
+			continue;
+		first = std::min(first, (-b - std::sqrt(disc)) / a);
+	}
+	return first;
+}
+
+}
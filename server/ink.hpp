@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <Box2D/Box2D.h>
+
+// Ink particles as a plain particle system instead of Box2D bodies. They move like the damped
+// sensor bodies they used to be, slow down the mobs they overlap through a grid of the mobs and
+// hide what is behind them from the line of sight checks, which test them after the world raycast.
+// Nothing of this touches the Box2D world, so ink doesn't add contacts or broadphase proxies.
+namespace ink {
+
+const float RADIUS = 0.6f;
+const uint16_t LIFETIME_FRAMES = 80; // 4s
+
+// structure of arrays, in the order the particles were launched
+struct Particles {
+	std::vector<uint16_t> movableID;
+	std::vector<float> x, y, velocityX, velocityY;
+	std::vector<uint16_t> lifetimeFrames;
+
+	size_t size() const { return movableID.size(); }
+};
+
+extern Particles particles;
+
+// the impulse is applied as to a body of density 1, like launching the old sensor body
+void launch(const b2Vec2& position, const b2Vec2& impulse, uint16_t movableID);
+void add(const b2Vec2& position, const b2Vec2& velocity, uint16_t movableID, uint16_t lifetimeFrames);
+bool contains(uint16_t movableID);
+void clear();
+
+// moves the particles one tick and removes the expired ones
+void update();
+// sets bombsAffecting of every mob to the number of particles overlapping it
+void applyToMobs();
+
+// the fraction of the segment at which it first enters a particle, a value above 1 if it doesn't,
+// a particle the segment starts in doesn't count, like a Box2D raycast
+float firstHit(const b2Vec2& from, const b2Vec2& to);
+
+}
@@ -0,0 +1,140 @@
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "../common/hash.hpp"
+
+#include "ink.hpp"
+#include "journal.hpp"
+#include "log.hpp"
+
+static std::ofstream journal;
+static flatbuffers::FlatBufferBuilder journalBuilder(1024);
+
+static void writeEntry(FlatBuffGenerated::JournalEvent type, flatbuffers::Offset<void> event)
+{
+	auto entry = FlatBuffGenerated::CreateJournalEntry(journalBuilder, type, event);
+	journalBuilder.FinishSizePrefixed(entry);
+	journal.write((const char*) journalBuilder.GetBufferPointer(), journalBuilder.GetSize());
+	journalBuilder.Clear();
+}
+
+void journalStart()
+{
+	if (!gameState.options.count("journaldir"))
+		return;
+	auto path = gameState.options["journaldir"].as<std::string>() + "/" + std::to_string(gameState.seed) + ".dfj";
+	journal.open(path, std::ios::binary | std::ios::trunc);
+	if (!journal) {
+		LOG_ERROR("could not open journal %s", path.c_str());
+		return;
+	}
+	LOG_INFO("journaling the match to %s", path.c_str());
+
+	std::vector<flatbuffers::Offset<FlatBuffGenerated::JournalPlayer>> players;
+	iterateOverMovableMap(gameState.players,
+		[&](Player& p){
+			players.push_back(FlatBuffGenerated::CreateJournalPlayer(journalBuilder,
+				p.movableID, p.playerID, journalBuilder.CreateString(p.name)));
+		}
+	);
+	auto start = FlatBuffGenerated::CreateJournalStart(journalBuilder, gameState.seed,
+		gameState.level->file->levelHash, gameState.options["ghosttown"].as<bool>(),
+		journalBuilder.CreateVector(players));
+	writeEntry(FlatBuffGenerated::JournalEvent_JournalStart, start.Union());
+}
+
+void journalCommand(Player& p, const std::string& payload)
+{
+	if (!journal.is_open())
+		return;
+	auto message = journalBuilder.CreateVector((const uint8_t*) payload.data(), payload.size());
+	auto command = FlatBuffGenerated::CreateJournalCommand(journalBuilder, gameState.tick, p.movableID, message);
+	writeEntry(FlatBuffGenerated::JournalEvent_JournalCommand, command.Union());
+}
+
+void journalLeave(Player& p)
+{
+	if (!journal.is_open())
+		return;
+	auto leave = FlatBuffGenerated::CreateJournalLeave(journalBuilder, gameState.tick, p.movableID);
+	writeEntry(FlatBuffGenerated::JournalEvent_JournalLeave, leave.Union());
+}
+
+void journalChecksum()
+{
+	if (!journal.is_open())
+		return;
+	auto checksum = FlatBuffGenerated::CreateJournalChecksum(journalBuilder, gameState.tick, worldChecksum());
+	writeEntry(FlatBuffGenerated::JournalEvent_JournalChecksum, checksum.Union());
+	// a crashed server leaves at most a second of the match unjournaled
+	if (gameState.tick % SECOND == 0)
+		journal.flush();
+}
+
+void journalEnd()
+{
+	if (journal.is_open())
+		journal.close();
+}
+
+template<typename T>
+static uint64_t hashValue(const T& value, uint64_t hash)
+{
+	return contentHash(&value, sizeof(value), hash);
+}
+
+uint64_t worldChecksum()
+{
+	uint64_t hash = hashValue(gameState.tick, contentHash(nullptr, 0));
+	for (auto body = gameState.b2world->GetBodyList(); body; body = body->GetNext()) {
+		hash = hashValue(body->GetPosition(), hash);
+		hash = hashValue(body->GetAngle(), hash);
+		hash = hashValue(body->GetLinearVelocity(), hash);
+	}
+	hash = hashValue(gameState.civilians.size(), hash);
+	hash = hashValue(ink::particles.size(), hash);
+	for (size_t i = 0; i < ink::particles.size(); i++)
+		hash = hashValue(b2Vec2(ink::particles.x[i], ink::particles.y[i]), hash);
+	hash = hashValue(gameState.mobManipulators.size(), hash);
+	iterateOverMovableMap(gameState.players,
+		[&](Player& p){
+			hash = hashValue(p.movableID, hash);
+			hash = hashValue(p.points, hash);
+			hash = hashValue(p.state, hash);
+		}
+	);
+	return hash;
+}
+
+bool readJournal(const std::string& path, std::vector<uint8_t>& data,
+	std::vector<const FlatBuffGenerated::JournalEntry*>& entries)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		std::cout << "could not open journal " << path << "\n";
+		return false;
+	}
+	data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+	size_t offset = 0;
+	while (offset + sizeof(flatbuffers::uoffset_t) <= data.size()) {
+		auto entry = data.data() + offset;
+		size_t size = sizeof(flatbuffers::uoffset_t) + flatbuffers::GetPrefixedSize(entry);
+		if (offset + size > data.size())
+			break;
+		flatbuffers::Verifier verifier(entry, size);
+		if (!verifier.VerifySizePrefixedBuffer<FlatBuffGenerated::JournalEntry>(nullptr))
+			break;
+		entries.push_back(flatbuffers::GetSizePrefixedRoot<FlatBuffGenerated::JournalEntry>(entry));
+		offset += size;
+	}
+	if (offset != data.size())
+		std::cout << "journal " << path << " is truncated after " << entries.size() << " entries\n";
+
+	if (entries.empty() || entries[0]->event_type() != FlatBuffGenerated::JournalEvent_JournalStart) {
+		std::cout << "journal " << path << " does not start with a JournalStart\n";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "deadfish.hpp"
+
+// Input journal of a match: the seed, the level hash and the players it started with, every
+// client command together with the tick it was applied before and a world checksum after every
+// tick. Written to <journaldir>/<seed>.dfj as size-prefixed JournalEntry buffers, replayed
+// with --replay. All functions expect the game lock, they do nothing unless a journal is open.
+
+// opens the journal of a fresh match, after the rng was seeded and before presimulation
+void journalStart();
+void journalCommand(Player& p, const std::string& payload);
+void journalLeave(Player& p);
+// after every tick, gameState.tick is the number of ticks simulated so far
+void journalChecksum();
+void journalEnd();
+
+// hash of every body in the world and of the match state the physics doesn't know about
+uint64_t worldChecksum();
+
+// reads all entries of a journal, data owns the memory entries point to. A truncated last
+// entry is dropped, the first entry is always a JournalStart
+bool readJournal(const std::string& path, std::vector<uint8_t>& data,
+	std::vector<const FlatBuffGenerated::JournalEntry*>& entries);
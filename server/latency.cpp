@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <chrono>
+
+#include "game_thread.hpp"
+#include "latency.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+#include "../common/constants.hpp"
+
+static const std::vector<double> LATENCY_BOUNDS = {0.01, 0.025, 0.05, 0.075, 0.1, 0.15, 0.2, 0.3, 0.5, 1};
+
+static metrics::Histogram rttSeconds("deadfish_rtt_seconds", "ping to pong round trip time of the connections", LATENCY_BOUNDS);
+static metrics::Histogram commandToTickSeconds("deadfish_command_to_tick_seconds",
+	"time from a move or kill command arriving to the end of the tick that applied it", LATENCY_BOUNDS);
+static metrics::Histogram commandToSnapshotSeconds("deadfish_command_to_snapshot_seconds",
+	"time from a move or kill command arriving to sending the WorldState that reflects it", LATENCY_BOUNDS);
+
+uint64_t latencyClock()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double secondsSince(uint64_t micros)
+{
+	return (latencyClock() - micros) / 1000000.0;
+}
+
+void sendPings()
+{
+	if (gameState.roundTimer % SECOND != 0)
+		return;
+	flatbuffers::FlatBufferBuilder builder;
+	iterateOverMovableMap(gameState.players,
+		[&](Player& p){
+			builder.Clear();
+			auto ping = FlatBuffGenerated::CreatePing(builder, latencyClock());
+			sendServerMessage(p, builder, FlatBuffGenerated::ServerMessageUnion_Ping, ping.Union());
+		}
+	);
+}
+
+void handlePong(Player& p, const FlatBuffGenerated::Pong* pong)
+{
+	if (pong->serverTime() > latencyClock())
+		return;
+	auto rtt = secondsSince(pong->serverTime());
+	rttSeconds.observe(rtt);
+	p.rttSamples.push_back(rtt);
+}
+
+void commandReceived(Player& p, uint64_t received)
+{
+	// only the oldest command waiting for a tick is timed
+	if (p.commandReceived == 0)
+		p.commandReceived = received;
+}
+
+void commandsApplied()
+{
+	iterateOverMovableMap(gameState.players,
+		[&](Player& p){
+			if (p.commandReceived != 0 && !p.commandApplied) {
+				commandToTickSeconds.observe(secondsSince(p.commandReceived));
+				p.commandApplied = true;
+			}
+		}
+	);
+}
+
+void snapshotSent(Player& p)
+{
+	if (!p.commandApplied)
+		return;
+	commandToSnapshotSeconds.observe(secondsSince(p.commandReceived));
+	p.commandReceived = 0;
+	p.commandApplied = false;
+}
+
+void logLatencySummary()
+{
+	iterateOverMovableMap(gameState.players,
+		[&](Player& p){
+			auto& samples = p.rttSamples;
+			if (samples.empty())
+				return;
+			std::sort(samples.begin(), samples.end());
+			LOG_INFO("rtt of %s: median %.0fms p99 %.0fms max %.0fms over %zu pings", p.name.c_str(),
+				samples[samples.size() / 2] * 1000, samples[samples.size() * 99 / 100] * 1000,
+				samples.back() * 1000, samples.size());
+		}
+	);
+	// with --rematch the next match in the process starts counting from zero, like the bandwidth summary
+	rttSeconds.reset();
+	commandToTickSeconds.reset();
+	commandToSnapshotSeconds.reset();
+}
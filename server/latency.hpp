@@ -0,0 +1,22 @@
+#pragma once
+
+#include "deadfish.hpp"
+
+// Round trip times of the connections and the latency from a command arriving in gameOnMessage
+// to the tick applying it and to the WorldState reflecting it. All functions expect the game lock.
+
+// pings every player once a second
+void sendPings();
+void handlePong(Player& p, const FlatBuffGenerated::Pong* pong);
+
+// steady clock in microseconds, safe to read without the game lock
+uint64_t latencyClock();
+// received is the latencyClock() reading of the command arriving, 0 for commands without one
+void commandReceived(Player& p, uint64_t received);
+// after gameThreadTick, every pending command has been applied by then
+void commandsApplied();
+// after the WorldState of p was sent
+void snapshotSent(Player& p);
+
+// logs the round trip times of the players of the match and resets the latency histograms
+void logLatencySummary();
@@ -1,82 +1,139 @@
-#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
 #include <flatbuffers/flatbuffers.h>
+#include "avoidance.hpp"
 #include "deadfish.hpp"
+#include "game_thread.hpp"
 #include "level_loader.hpp"
+#include "sight.hpp"
 #include "../common/constants.hpp"
+#include "../common/hash.hpp"
+
+// side of the square tiles the static level geometry is grouped into, every tile gets one body
+const float STATIC_TILE_SIZE = 16.f;
+
+// the static body of the tile the point is in, created when the first object lands in the tile
+static b2Body* tileBody(float x, float y)
+{
+	auto key = std::make_pair((int) std::floor(x / STATIC_TILE_SIZE), (int) std::floor(y / STATIC_TILE_SIZE));
+	auto& body = gameState.level->tileBodies[key];
+	if (!body) {
+		b2BodyDef myBodyDef;
+		myBodyDef.type = b2_staticBody;
+		body = gameState.b2world->CreateBody(&myBodyDef);
+	}
+	return body;
+}
 
 void initPlayerwall(const FlatBuffGenerated::PlayerWall *pw)
 {
 	std::cout << "playerwall " << pw->position()->x() << "," << pw->position()->y() << "; " << pw->size()->x() << "," << pw->size()->y() << "\n";
-	b2BodyDef myBodyDef;
-	myBodyDef.type = b2_staticBody;
-	myBodyDef.position.Set(pw->position()->x(), pw->position()->y());
-	myBodyDef.angle = pw->rotation() * TO_RADIANS;
-	b2Body *staticBody = gameState.b2world->CreateBody(&myBodyDef); //add body to world
+	b2Vec2 position(pw->position()->x(), pw->position()->y());
+	b2Body *staticBody = tileBody(position.x, position.y);
 	b2PolygonShape boxShape;
-	boxShape.SetAsBox(pw->size()->x(), pw->size()->y());
+	boxShape.SetAsBox(pw->size()->x(), pw->size()->y(), position, pw->rotation() * TO_RADIANS);
+	auto wall = std::make_unique<PlayerWall>();
 	b2FixtureDef boxFixtureDef;
 	boxFixtureDef.shape = &boxShape;
 	boxFixtureDef.density = 1;
 	boxFixtureDef.filter.maskBits = ~1;
 	boxFixtureDef.filter.categoryBits = 1 << 1;
-	staticBody->CreateFixture(&boxFixtureDef); //add fixture to body
-	gameState.level->playerwalls.emplace_back(std::make_unique<PlayerWall>());
-	staticBody->SetUserData(gameState.level->playerwalls.back().get());
-	gameState.level->playerwalls.back()->body = staticBody;
+	boxFixtureDef.userData = wall.get();
+	wall->body = staticBody;
+	wall->fixture = staticBody->CreateFixture(&boxFixtureDef); //add fixture to body
+	gameState.level->playerwalls.push_back(std::move(wall));
 }
 
-flatbuffers::Offset<FlatBuffGenerated::Level> serializeLevel(flatbuffers::FlatBufferBuilder &builder)
+const uint16_t MAX_TILE_RUN = UINT16_MAX;
+
+static std::vector<uint16_t> encodeTiledataRle(const flatbuffers::Vector<uint16_t>& tiledata)
+{
+	std::vector<uint16_t> ret;
+	for (size_t i = 0; i < tiledata.size();) {
+		uint16_t gid = tiledata[i];
+		uint16_t run = 0;
+		while (i < tiledata.size() && tiledata[i] == gid && run < MAX_TILE_RUN) {
+			run++;
+			i++;
+		}
+		ret.push_back(run);
+		ret.push_back(gid);
+	}
+	return ret;
+}
+
+static flatbuffers::Offset<FlatBuffGenerated::Level> serializeLevel(flatbuffers::FlatBufferBuilder &builder,
+	const FlatBuffGenerated::Level* fbLevel)
 {
 	//tileinfo
 	std::vector<flatbuffers::Offset<FlatBuffGenerated::Tileinfo>> tileinfoOffsets;
-	for (auto &ts : gameState.level->tileinfo) {
-		auto name = builder.CreateString(ts->name);
-		auto offset = FlatBuffGenerated::CreateTileinfo(builder, ts->gid, name);
+	for (auto ti : *fbLevel->tileinfo()) {
+		auto name = builder.CreateString(ti->name());
+		auto offset = FlatBuffGenerated::CreateTileinfo(builder, ti->gid(), name);
 		tileinfoOffsets.push_back(offset);
 	}
 	auto tilesets = builder.CreateVector(tileinfoOffsets);
 
 	// objects
 	std::vector<flatbuffers::Offset<FlatBuffGenerated::Object>> objectOffsets;
-	for (auto &o : gameState.level->objects) {
-		FlatBuffGenerated::Vec2 pos(o->pos.x, o->pos.y);
-		FlatBuffGenerated::Vec2 size(o->size.x, o->size.y);
-		auto hspotname = builder.CreateString(o->hspotname);
-		auto offset = FlatBuffGenerated::CreateObject(builder, &pos, o->rotation, &size, o->gid, hspotname);
+	for (auto o : *fbLevel->objects()) {
+		auto hspotname = builder.CreateString(o->hspotname());
+		auto offset = FlatBuffGenerated::CreateObject(builder, o->pos(), o->rotation(), o->size(), o->gid(), hspotname);
 		objectOffsets.push_back(offset);
 	}
 	auto objects = builder.CreateVector(objectOffsets);
 
 	// decoration
 	std::vector<flatbuffers::Offset<FlatBuffGenerated::Decoration>> decorationOffsets;
-	for (auto &d : gameState.level->decoration) {
-		FlatBuffGenerated::Vec2 pos(d->pos.x, d->pos.y);
-		FlatBuffGenerated::Vec2 size(d->size.x, d->size.y);
-		auto offset = FlatBuffGenerated::CreateDecoration(builder, &pos, d->rotation, &size, d->gid);
+	for (auto d : *fbLevel->decoration()) {
+		auto offset = FlatBuffGenerated::CreateDecoration(builder, d->pos(), d->rotation(), d->size(), d->gid());
 		decorationOffsets.push_back(offset);
 	}
 	auto decoration = builder.CreateVector(decorationOffsets);
 
-	// tilelayer
-	Tilelayer& tilelayer = *gameState.level->tilelayer;
-	auto dataOffset = builder.CreateVector<uint16_t>(tilelayer.tiledata);
-	FlatBuffGenerated::Vec2 tilesize(tilelayer.tilesize.x, tilelayer.tilesize.y);
-	auto tilelayerOffset = FlatBuffGenerated::CreateTilelayer(builder, tilelayer.width, tilelayer.height, &tilesize, dataOffset);
+	// tilelayer, run length encoded since most levels are large areas of the same tile
+	flatbuffers::Offset<FlatBuffGenerated::Tilelayer> tilelayerOffset = 0;
+	if (auto tl = fbLevel->tilelayer()) {
+		auto rle = encodeTiledataRle(*tl->tiledata());
+		auto rleOffset = builder.CreateVector(rle);
+		tilelayerOffset = FlatBuffGenerated::CreateTilelayer(builder, tl->width(), tl->height(), tl->tilesize(), 0, rleOffset);
+	}
 
 	// collision masks
 	std::vector<flatbuffers::Offset<FlatBuffGenerated::CollisionMask>> collisionMaskOffsets;
-	for (const auto& cm : gameState.level->collisionMasks) {
-		auto offset = cm->serialize(builder);
+	for (auto cm : *fbLevel->collisionMasks()) {
+		auto offset = CollisionMask::serialize(builder, cm);
 		collisionMaskOffsets.push_back(offset);
 	}
 	auto collisionMasks = builder.CreateVector(collisionMaskOffsets);
 
 	// final
-	FlatBuffGenerated::Vec2 size(gameState.level->size.x, gameState.level->size.y);
-	auto level = FlatBuffGenerated::CreateLevel(builder, objects, decoration, 0, collisionMasks, 0, 0, tilesets, tilelayerOffset, &size);
+	auto level = FlatBuffGenerated::CreateLevel(builder, objects, decoration, 0, collisionMasks, 0, 0, tilesets, tilelayerOffset, fbLevel->size());
 	return level;
 }
 
+static std::string compressLevelMessage(const std::string& levelMessage)
+{
+	uLongf compressedSize = compressBound(levelMessage.size());
+	std::vector<uint8_t> compressed(compressedSize);
+	if (compress2(compressed.data(), &compressedSize, (const Bytef*) levelMessage.data(),
+		levelMessage.size(), Z_BEST_COMPRESSION) != Z_OK)
+	{
+		std::cout << "failed to compress the level message\n";
+		return "";
+	}
+
+	flatbuffers::FlatBufferBuilder builder;
+	auto data = builder.CreateVector(compressed.data(), compressedSize);
+	auto offset = FlatBuffGenerated::CreateCompressedLevel(builder, levelMessage.size(), data);
+	return makeServerMessage(builder, FlatBuffGenerated::ServerMessageUnion_CompressedLevel, offset.Union());
+}
+
 std::ostream &operator<<(std::ostream &os, std::vector<std::string> &v)
 {
 	for (auto s : v)
@@ -92,60 +149,110 @@ std::ostream &operator<<(std::ostream &os, NavPoint &n)
 	return os;
 }
 
-void loadLevel(std::string &path)
+LevelFile::~LevelFile()
 {
-	std::ifstream in;
-	in.open(path, std::ios::in | std::ios::binary | std::ios::ate);
-	if (!in.is_open())
-	{
-		std::cout << "failed to open level file " << path << "\n";
-		exit(1);
-	}
-	auto size = in.tellg();
-	std::vector<char> memblock(size);
-	in.seekg(0, std::ios::beg);
-	in.read(memblock.data(), memblock.size());
-	in.close();
+	if (this->data)
+		munmap((void*) this->data, this->size);
+}
+
+const FlatBuffGenerated::Level* LevelFile::level() const
+{
+	return flatbuffers::GetRoot<FlatBuffGenerated::Level>(this->data);
+}
 
-	auto level = flatbuffers::GetRoot<FlatBuffGenerated::Level>(memblock.data());
+const std::string& LevelFile::clientMessage() const
+{
+	if (!this->compressedLevelMessage.empty())
+		return this->compressedLevelMessage;
+	return this->levelMessage;
+}
 
-	// tilelayer
-	if (level->tilelayer()) {
-		auto tl = std::make_unique<Tilelayer>(level->tilelayer());
-		gameState.level->tilelayer = std::move(tl);
+std::shared_ptr<LevelFile> LevelFile::open(const std::string& path)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		std::cout << "failed to open level file " << path << "\n";
+		return nullptr;
 	}
-
-	// tilesets
-	for (auto tileinfo : *level->tileinfo()) {
-		auto ti = std::make_unique<Tileinfo>(tileinfo);
-		gameState.level->tileinfo.push_back(std::move(ti));
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		std::cout << "failed to stat level file " << path << "\n";
+		::close(fd);
+		return nullptr;
 	}
-
-	// objects
-	for (auto object : *level->objects())
+	void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED)
 	{
-		auto o = std::make_unique<Object>(object);
-		gameState.level->objects.push_back(std::move(o));
+		std::cout << "failed to map level file " << path << "\n";
+		return nullptr;
 	}
 
-	// decoration
-	for (auto decoration : *level->decoration())
+	auto file = std::shared_ptr<LevelFile>(new LevelFile());
+	file->path = path;
+	file->data = (const uint8_t*) addr;
+	file->size = st.st_size;
+
+	flatbuffers::Verifier verifier(file->data, file->size);
+	if (!verifier.VerifyBuffer<FlatBuffGenerated::Level>(nullptr))
 	{
-		auto d = std::make_unique<Decoration>(decoration);
-		gameState.level->decoration.push_back(std::move(d));
+		std::cout << "level file " << path << " is not a valid level\n";
+		return nullptr;
 	}
 
+	// build what the clients get once, they all get the same bytes for every match
+	flatbuffers::FlatBufferBuilder builder;
+	auto levelOffset = serializeLevel(builder, file->level());
+	file->levelMessage = makeServerMessage(builder, FlatBuffGenerated::ServerMessageUnion_Level, levelOffset.Union());
+	file->levelHash = contentHash(file->levelMessage.data(), file->levelMessage.size());
+	if (gameState.options["compresslevel"].as<bool>())
+		file->compressedLevelMessage = compressLevelMessage(file->levelMessage);
+	std::cout << "level message " << file->levelMessage.size() << " bytes, compressed " <<
+		file->compressedLevelMessage.size() << " bytes\n";
+
+	// the render-only tables are not needed anymore, let the kernel reclaim their pages,
+	// loadLevel faults back in just the gameplay tables it reads
+	madvise((void*) file->data, file->size, MADV_DONTNEED);
+	return file;
+}
+
+std::shared_ptr<const LevelFile> getLevelFile(const std::string& path)
+{
+	static std::mutex cacheMutex;
+	static std::map<std::string, std::shared_ptr<const LevelFile>> cache;
+
+	std::lock_guard<std::mutex> guard(cacheMutex);
+	auto it = cache.find(path);
+	if (it != cache.end())
+		return it->second;
+	auto file = LevelFile::open(path);
+	if (file)
+		cache[path] = file;
+	return file;
+}
+
+void loadLevel(std::string &path)
+{
+	auto file = getLevelFile(path);
+	if (!file)
+		exit(1);
+
+	auto level = file->level();
+	gameState.level->file = file;
+
 	// hiding spots
 	for (auto hspot : *level->hidingspots())
 	{
-		auto hs = std::make_unique<HidingSpot>(hspot);
+		auto hs = std::make_unique<HidingSpot>(hspot, tileBody(hspot->pos()->x(), hspot->pos()->y()));
 		gameState.level->hidingspots.push_back(std::move(hs));
 	}
 
 	// collisionMasks
 	for (auto cmask : *level->collisionMasks())
 	{
-		auto s = std::make_unique<CollisionMask>(cmask);
+		auto s = std::make_unique<CollisionMask>(cmask, tileBody(cmask->pos()->x(), cmask->pos()->y()));
 		gameState.level->collisionMasks.push_back(std::move(s));
 	}
 
@@ -169,4 +276,12 @@ void loadLevel(std::string &path)
 		}
 		gameState.level->navpoints[navpoint->name()->str()] = std::move(n);
 	}
+	for (auto& n : gameState.level->navpoints) {
+		if (n.second->isspawn)
+			gameState.level->civilianSpawns.emplace_back(n.first, n.second.get());
+	}
+	std::sort(gameState.level->civilianSpawns.begin(), gameState.level->civilianSpawns.end());
+
+	avoidance::buildObstacleGrid();
+	sight::build();
 }
@@ -1,4 +1,33 @@
 #pragma once
 
+#include <memory>
+#include <string>
+
+// A read-only, verified mapping of a level file. Mappings are cached per path,
+// so every match in the process playing the same level shares one copy.
+struct LevelFile {
+	~LevelFile();
+
+	const FlatBuffGenerated::Level* level() const;
+	// the Level server message, compressed if the server was asked to
+	const std::string& clientMessage() const;
+
+	std::string path;
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+	std::string levelMessage;
+	std::string compressedLevelMessage;
+	// contentHash of levelMessage, clients cache the level under it
+	uint64_t levelHash = 0;
+
+	// returns nullptr if the file could not be mapped or is not a valid level
+	static std::shared_ptr<LevelFile> open(const std::string& path);
+
+private:
+	LevelFile() {}
+	LevelFile(const LevelFile&) = delete;
+};
+
+std::shared_ptr<const LevelFile> getLevelFile(const std::string& path);
 void loadLevel(std::string& path);
-flatbuffers::Offset<FlatBuffGenerated::Level> serializeLevel(flatbuffers::FlatBufferBuilder& builder);
\ No newline at end of file
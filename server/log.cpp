@@ -0,0 +1,103 @@
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+#include "log.hpp"
+
+namespace dflog {
+
+std::atomic<int> minLevel{(int) Level::INFO};
+
+static const size_t RING_SIZE = 1024;
+static const size_t TEXT_SIZE = 240;
+
+// a bounded multi-producer ring, seq tells whose turn it is to use the slot
+struct Slot {
+	std::atomic<uint64_t> seq;
+	Level level;
+	char text[TEXT_SIZE];
+};
+
+static Slot ring[RING_SIZE];
+static std::atomic<uint64_t> head{0};
+static std::atomic<uint64_t> dropped{0};
+
+static const char* LEVEL_NAMES[] = { "debug", "info", "warn", "error", "off" };
+
+static struct RingInit {
+	RingInit() {
+		for (size_t i = 0; i < RING_SIZE; i++)
+			ring[i].seq.store(i, std::memory_order_relaxed);
+	}
+} ringInit;
+
+bool parseLevel(const std::string& name, Level& level)
+{
+	for (int i = 0; i <= (int) Level::OFF; i++) {
+		if (name == LEVEL_NAMES[i]) {
+			level = (Level) i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void setLevel(Level level)
+{
+	minLevel.store((int) level, std::memory_order_relaxed);
+}
+
+void write(Level level, const char* fmt, ...)
+{
+	uint64_t pos = head.load(std::memory_order_relaxed);
+	Slot* slot;
+	while (true) {
+		slot = &ring[pos % RING_SIZE];
+		int64_t diff = (int64_t) slot->seq.load(std::memory_order_acquire) - (int64_t) pos;
+		if (diff == 0) {
+			if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			// the drain thread did not catch up, better lose a message than stall the tick
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = head.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->level = level;
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(slot->text, TEXT_SIZE, fmt, args);
+	va_end(args);
+	slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+static void drain()
+{
+	uint64_t tail = 0;
+	while (true) {
+		Slot& slot = ring[tail % RING_SIZE];
+		if (slot.seq.load(std::memory_order_acquire) != tail + 1) {
+			auto lost = dropped.exchange(0, std::memory_order_relaxed);
+			if (lost > 0)
+				fprintf(stdout, "[warn] log ring full, dropped %lu messages\n", (unsigned long) lost);
+			fflush(stdout);
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			continue;
+		}
+		fprintf(stdout, "[%s] %s\n", LEVEL_NAMES[(int) slot.level], slot.text);
+		slot.seq.store(tail + RING_SIZE, std::memory_order_release);
+		tail++;
+	}
+}
+
+void start()
+{
+	new std::thread(drain);
+}
+
+}; // dflog
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+// Leveled logger for the game thread. Messages are formatted straight into a preallocated
+// lock-free ring and written out by a background thread, so logging never blocks on stdout
+// while the game lock is held. Messages below the level are skipped before any formatting.
+namespace dflog {
+
+enum class Level : int {
+	DEBUG = 0,
+	INFO,
+	WARN,
+	ERROR,
+	OFF
+};
+
+extern std::atomic<int> minLevel;
+
+static inline bool enabled(Level level)
+{
+	return (int) level >= minLevel.load(std::memory_order_relaxed);
+}
+
+// returns false if name is not one of debug, info, warn, error or off
+bool parseLevel(const std::string& name, Level& level);
+void setLevel(Level level);
+// starts the thread draining the ring, messages logged before are kept until then
+void start();
+// printf-style, messages longer than a ring slot are truncated and a full ring drops them
+void write(Level level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+}; // dflog
+
+#define DFLOG(level, ...) do { if (dflog::enabled(level)) dflog::write(level, __VA_ARGS__); } while (0)
+#define LOG_DEBUG(...) DFLOG(dflog::Level::DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) DFLOG(dflog::Level::INFO, __VA_ARGS__)
+#define LOG_WARN(...) DFLOG(dflog::Level::WARN, __VA_ARGS__)
+#define LOG_ERROR(...) DFLOG(dflog::Level::ERROR, __VA_ARGS__)
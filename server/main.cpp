@@ -1,32 +1,43 @@
+#include <csignal>
 #include <iostream>
+#include <random>
 #include <utility>
 #include "flatbuffers/flatbuffers.h"
 
 #include "agones.hpp"
+#include "alloc_tracking.hpp"
 #include "deadfish.hpp"
+#include "checkpoint.hpp"
+#include "journal.hpp"
 #include "game_thread.hpp"
+#include "level_loader.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+#include "recorder.hpp"
+#include "sight.hpp"
+#include "steering.hpp"
+#include "trace.hpp"
 #include "websocket.hpp"
+#include "workers.hpp"
 
 GameState gameState;
 
 void sendInitMetadata()
 {
-	for (auto &targetPlayerIt : gameState.players)
-	{
-		auto &targetPlayer = targetPlayerIt.second;
-		flatbuffers::FlatBufferBuilder builder(1);
-		std::vector<flatbuffers::Offset<FlatBuffGenerated::InitPlayer>> playerOffsets;
-		for (auto& playerIt : gameState.players)
-		{
-			auto& player = playerIt.second;
-			auto name = builder.CreateString(player->name.c_str());
-			auto playerOffset = FlatBuffGenerated::CreateInitPlayer(builder, player->playerID, name, player->species, player->ready);
-			playerOffsets.push_back(playerOffset);
+	iterateOverMovableMap(gameState.players,
+		[](Player& p){
+			sendInitMetadata(p);
 		}
-		auto players = builder.CreateVector(playerOffsets);
-		auto metadata = FlatBuffGenerated::CreateInitMetadata(builder, players, targetPlayer->movableID, targetPlayer->playerID);
-		sendServerMessage(*targetPlayer, builder, FlatBuffGenerated::ServerMessageUnion_InitMetadata, metadata.Union());
-	}
+	);
+}
+
+uint64_t newSessionToken()
+{
+	static std::random_device rd;
+	uint64_t token = 0;
+	while (token == 0)
+		token = ((uint64_t) rd() << 32) | rd();
+	return token;
 }
 
 void addNewPlayer(dfws::Handle hdl, const std::string &name)
@@ -42,6 +53,7 @@ void addNewPlayer(dfws::Handle hdl, const std::string &name)
 	p->name = name;
 	p->wsHandle = hdl;
 	p->playerID = gameState.players.size();
+	p->sessionToken = newSessionToken();
 
 	gameState.players[p->movableID] = std::move(p);
 
@@ -51,9 +63,23 @@ void addNewPlayer(dfws::Handle hdl, const std::string &name)
 
 void startGame() {
 	gameState.phase = GamePhase::GAME;
+	discardCheckpointRequest();
 	dfws::SetOnMessage(&gameOnMessage);
 	agones::SetPlaying();
-	new std::thread(gameThread); // leak the shit out of it yooo
+	new std::thread(gameThread, false); // leak the shit out of it yooo
+}
+
+void mainOnMessage(dfws::Handle hdl, const std::string& payload);
+
+void returnToLobby() {
+	gameState.phase = GamePhase::LOBBY;
+	// the clients don't go back to their lobby after GameEnded, they have to connect again to join
+	// the next match
+	dfws::CloseAll();
+	dfws::SetOnMessage(&mainOnMessage);
+	agones::SetPlayers(gameState.players.size());
+	agones::SetReady();
+	std::cout << "match recycled, back in the lobby\n";
 }
 
 void mainOnMessage(dfws::Handle hdl, const std::string& payload)
@@ -68,7 +94,7 @@ void mainOnMessage(dfws::Handle hdl, const std::string& payload)
 	case FlatBuffGenerated::ClientMessageUnion::ClientMessageUnion_JoinRequest:
 	{
 		const auto event = clientMessage->event_as_JoinRequest();
-		if (gameState.players.size() == 6) {
+		if (gameState.players.size() >= (size_t) MAX_PLAYERS) {
 			sendGameAlreadyInProgress(hdl);
 			std::cout << "player " << event->name()->c_str() << " dropped, too many players\n";
 			return;
@@ -110,6 +136,7 @@ void mainOnMessage(dfws::Handle hdl, const std::string& payload)
 
 void mainOnClose(dfws::Handle hdl)
 {
+	const auto guard = gameState.lock();
 	auto playerIt = gameState.players.begin();
 	while (playerIt != gameState.players.end())
 	{
@@ -117,6 +144,8 @@ void mainOnClose(dfws::Handle hdl)
 		if (player->wsHandle == hdl)
 		{
 			std::cout << "deleting player " << player->name << "\n";
+			if (gameState.phase == GamePhase::GAME)
+				journalLeave(*player);
 			break;
 		}
 		playerIt++;
@@ -129,15 +158,26 @@ void mainOnClose(dfws::Handle hdl)
 		agones::SetPlayers(gameState.players.size());
 		sendInitMetadata();
 	}
-	if (gameState.phase == GamePhase::GAME && gameState.players.empty())
+	if (gameState.phase == GamePhase::GAME && gameState.players.empty() && !gameState.options["rematch"].as<bool>())
 	{
 		std::cout << "no players left, exiting\n";
 		agones::Shutdown();
 	}
 }
 
+// true if the match was restored from a checkpoint and some players did not reconnect yet
+bool awaitingRejoin()
+{
+	for (auto& p : gameState.players) {
+		if (p.second->wsHandle == dfws::INVALID_HANDLE)
+			return true;
+	}
+	return false;
+}
+
 void mainOnOpen(dfws::Handle hdl) {
-	if (gameState.phase == GamePhase::GAME) {
+	const auto guard = gameState.lock();
+	if (gameState.phase == GamePhase::GAME && !awaitingRejoin()) {
 		sendGameAlreadyInProgress(hdl);
 		return;
 	}
@@ -163,8 +203,29 @@ bool handleCliOptions(int argc, const char* const argv[]) {
 		("port,p", boost_po::value<int>(), "the port on which the server will be accepting connections")
 		("level,l", boost_po::value<std::string>(), "level flatbuffer file to be loaded by the server")
 		("numplayers,n", boost_po::value<unsigned long>(), "the server will launch the game after the specified amount of players will appear in lobby, not when everybody is ready")
+		("maxcivilians", boost_po::value<uint32_t>()->default_value(MAX_CIVILIANS), "civilians are spawned up to this count" )
+		("avoidance", boost_po::value<bool>()->default_value(true)->implicit_value(true), "civilians steer around each other and the walls ahead instead of only reacting once stuck" )
+		("visibilitypolygon", boost_po::value<bool>()->default_value(false)->implicit_value(true), "cull what players can't see with a visibility polygon of the level per player before casting rays" )
+		("workers", boost_po::value<uint32_t>()->default_value(0), "extra threads the civilians decide their moves on, 0 keeps everything on the game thread" )
 		("ghosttown,g", boost_po::value<bool>()->default_value(false)->implicit_value(true), "no mobs mode" )
 		("agones", boost_po::value<bool>()->default_value(false)->implicit_value(true), "run the server with agones sdk thread" )
+		("rematch", boost_po::value<bool>()->default_value(false)->implicit_value(true), "go back to the lobby after a match instead of shutting down" )
+		("checkpoint", boost_po::value<std::string>(), "on SIGUSR1 write the running match to this file and shut down" )
+		("restore", boost_po::value<std::string>(), "resume the match from a checkpoint file instead of starting in the lobby" )
+		("metricsport", boost_po::value<int>(), "serve prometheus metrics over http on this port" )
+		("tracefile", boost_po::value<std::string>(), "record tick phase traces, written to this file as chrome trace json on SIGUSR2" )
+		("traceticks", boost_po::value<uint32_t>()->default_value(0), "also write the trace after this many ticks" )
+		("loglevel", boost_po::value<std::string>()->default_value("info"), "debug, info, warn, error or off" )
+		("bench", boost_po::value<uint32_t>(), "run this many ticks headless with bot players as fast as possible and exit" )
+		("benchsteering", boost_po::value<uint32_t>(), "time the batched steering kernel against Mob::update on this many mobs and exit" )
+		("benchsight", boost_po::value<uint32_t>(), "time line of sight checks against box2d raycasts on this many random rays and exit" )
+		("allocbudget", boost_po::value<int64_t>(), "in bench mode fail if a steady state tick allocates more often, needs a DEADFISH_ALLOC_TRACKING build and --workers 0" )
+		("seed", boost_po::value<uint64_t>(), "seed of the match simulation, random if not given" )
+		("journaldir", boost_po::value<std::string>(), "journal the seed and every client command of the match into this directory, not with --rematch" )
+		("recorddir", boost_po::value<std::string>(), "record a seekable snapshot of every tick of each match into this directory" )
+		("replay", boost_po::value<std::string>(), "rerun a journaled match headless, check it against its recorded checksums and exit" )
+		("verifyrecording", boost_po::value<std::string>(), "read a recording back, check that seeking through its index rebuilds every tick and exit" )
+		("compresslevel", boost_po::value<bool>()->default_value(false)->implicit_value(true), "send the level to clients zlib-compressed" )
 	;
 
 	boost_po::store(boost_po::parse_command_line(argc, argv, desc), gameState.options);
@@ -175,19 +236,71 @@ bool handleCliOptions(int argc, const char* const argv[]) {
 		return false;
 	}
 
-	if (!ensureMandatoryOption<int>("port") || !ensureMandatoryOption<std::string>("level"))
+	if (!ensureMandatoryOption<std::string>("level"))
+		return false;
+	// the benches and the replay do not listen on any port
+	if (!gameState.options.count("bench") && !gameState.options.count("benchsteering") && !gameState.options.count("benchsight")
+		&& !gameState.options.count("replay") && !gameState.options.count("verifyrecording")
+		&& !ensureMandatoryOption<int>("port"))
+		return false;
+	if (gameState.options.count("allocbudget") && !alloctrack::compiled) {
+		std::cout << "allocbudget needs a server built with DEADFISH_ALLOC_TRACKING\n";
+		return false;
+	}
+	// the civilians deciding on the workers would allocate where the game thread does not count
+	if (gameState.options.count("allocbudget") && gameState.options["workers"].as<uint32_t>() != 0) {
+		std::cout << "allocbudget only counts the game thread, it needs --workers 0\n";
+		return false;
+	}
+	// a rematch keeps the world of the previous match, a journal only holds the seed to rebuild a fresh one
+	if (gameState.options.count("journaldir") && gameState.options["rematch"].as<bool>()) {
+		std::cout << "journaldir cannot be used with --rematch, only a match started from a fresh world can be replayed\n";
 		return false;
+	}
 
 	return true;
 }
 
 int main(int argc, const char* const argv[])
 {
-	srand(time(nullptr));
-
 	if (!handleCliOptions(argc, argv))
 		return 1;
 
+	gameState.seed = gameState.options.count("seed") ? gameState.options["seed"].as<uint64_t>() : std::random_device{}();
+	gameState.rng.seed(gameState.seed);
+
+	dflog::Level logLevel;
+	if (!dflog::parseLevel(gameState.options["loglevel"].as<std::string>(), logLevel)) {
+		std::cout << "unknown log level " << gameState.options["loglevel"].as<std::string>() << "\n";
+		return 1;
+	}
+	dflog::setLevel(logLevel);
+	dflog::start();
+	workers::start(gameState.options["workers"].as<uint32_t>());
+
+	// map the level and build its client message up front, matches only pick up the cached file
+	if (!getLevelFile(gameState.options["level"].as<std::string>()))
+		return 1;
+
+	if (gameState.options.count("bench"))
+		return runBench(gameState.options["bench"].as<uint32_t>());
+	if (gameState.options.count("benchsteering"))
+		return steering::runBench(gameState.options["benchsteering"].as<uint32_t>());
+	if (gameState.options.count("benchsight"))
+		return sight::runBench(gameState.options["benchsight"].as<uint32_t>());
+	if (gameState.options.count("replay"))
+		return runReplay(gameState.options["replay"].as<std::string>());
+	if (gameState.options.count("verifyrecording"))
+		return verifyRecording(gameState.options["verifyrecording"].as<std::string>());
+
+	if (gameState.options.count("checkpoint"))
+		std::signal(SIGUSR1, [](int){ requestCheckpoint(); });
+
+	if (gameState.options.count("tracefile")) {
+		trace::start(gameState.options["tracefile"].as<std::string>(), gameState.options["traceticks"].as<uint32_t>());
+		std::signal(SIGUSR2, [](int){ trace::requestDump(); });
+	}
+
 	dfws::SetOnMessage(&mainOnMessage);
 	dfws::SetOnOpen(&mainOnOpen);
 	dfws::SetOnClose(&mainOnClose);
@@ -200,6 +313,19 @@ int main(int argc, const char* const argv[])
 			return -1;
 		}
 
+	if (gameState.options.count("restore")) {
+		if (!restoreCheckpoint(gameState.options["restore"].as<std::string>()))
+			return 1;
+		gameState.phase = GamePhase::GAME;
+		dfws::SetOnMessage(&gameOnMessage);
+		agones::SetPlaying();
+		new std::thread(gameThread, true);
+	}
+
+	if (gameState.options.count("metricsport"))
+		if (!dfws::ServeHttp(gameState.options["metricsport"].as<int>(), "/metrics", &metrics::render))
+			return 1;
+
 	int port = gameState.options["port"].as<int>();
 
 	dfws::Run(port);
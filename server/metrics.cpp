@@ -0,0 +1,140 @@
+#include <sstream>
+
+#include "metrics.hpp"
+
+namespace metrics {
+
+static std::vector<Metric*>& registry()
+{
+	static std::vector<Metric*> metrics;
+	return metrics;
+}
+
+static void renderHeader(std::ostream& os, const Metric& m, const char* type)
+{
+	os << "# HELP " << m.name << " " << m.help << "\n";
+	os << "# TYPE " << m.name << " " << type << "\n";
+}
+
+Metric::Metric(const char* name, const char* help) : name(name), help(help)
+{
+	registry().push_back(this);
+}
+
+void Counter::render(std::ostream& os) const
+{
+	renderHeader(os, *this, "counter");
+	os << name << " " << get() << "\n";
+}
+
+void Gauge::render(std::ostream& os) const
+{
+	renderHeader(os, *this, "gauge");
+	os << name << " " << value.load(std::memory_order_relaxed) << "\n";
+}
+
+Histogram::Histogram(const char* name, const char* help, std::vector<double> bounds)
+	: Metric(name, help), bounds(std::move(bounds)), buckets(new std::atomic<uint64_t>[this->bounds.size()])
+{
+	for (size_t i = 0; i < this->bounds.size(); i++)
+		buckets[i] = 0;
+}
+
+void Histogram::observe(double v)
+{
+	for (size_t i = 0; i < bounds.size(); i++) {
+		if (v <= bounds[i]) {
+			buckets[i].fetch_add(1, std::memory_order_relaxed);
+			break;
+		}
+	}
+	count.fetch_add(1, std::memory_order_relaxed);
+	double old = sum.load(std::memory_order_relaxed);
+	while (!sum.compare_exchange_weak(old, old + v, std::memory_order_relaxed)) {}
+}
+
+void Histogram::reset()
+{
+	for (size_t i = 0; i < bounds.size(); i++)
+		buckets[i].store(0, std::memory_order_relaxed);
+	count.store(0, std::memory_order_relaxed);
+	sum.store(0, std::memory_order_relaxed);
+}
+
+void Histogram::render(std::ostream& os) const
+{
+	renderHeader(os, *this, "histogram");
+	// prometheus buckets are cumulative
+	uint64_t cumulative = 0;
+	for (size_t i = 0; i < bounds.size(); i++) {
+		cumulative += buckets[i].load(std::memory_order_relaxed);
+		os << name << "_bucket{le=\"" << bounds[i] << "\"} " << cumulative << "\n";
+	}
+	auto total = count.load(std::memory_order_relaxed);
+	os << name << "_bucket{le=\"+Inf\"} " << total << "\n";
+	os << name << "_sum " << sum.load(std::memory_order_relaxed) << "\n";
+	os << name << "_count " << total << "\n";
+}
+
+LabeledCounter::LabeledCounter(const char* name, const char* help, const char* label)
+	: Metric(name, help), label(label) {}
+
+LabeledCounter::Child LabeledCounter::child(const std::string& labelValue)
+{
+	std::lock_guard<std::mutex> guard(mut);
+	auto& c = values[labelValue];
+	if (!c)
+		c = std::make_shared<std::atomic<uint64_t>>(0);
+	return c;
+}
+
+void LabeledCounter::remove(const std::string& labelValue)
+{
+	std::lock_guard<std::mutex> guard(mut);
+	values.erase(labelValue);
+}
+
+void LabeledCounter::render(std::ostream& os) const
+{
+	renderHeader(os, *this, "counter");
+	std::lock_guard<std::mutex> guard(mut);
+	for (auto& v : values)
+		os << name << "{" << label << "=\"" << v.first << "\"} " << v.second->load(std::memory_order_relaxed) << "\n";
+}
+
+std::string render()
+{
+	std::ostringstream os;
+	for (auto m : registry())
+		m->render(os);
+	return os.str();
+}
+
+static const std::vector<double> TICK_BOUNDS = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25};
+
+Histogram tickSeconds("deadfish_tick_seconds", "time the game thread spends on a tick with the game lock held", TICK_BOUNDS);
+Histogram physicsStepSeconds("deadfish_physics_step_seconds", "time of a single box2d world step", TICK_BOUNDS);
+Histogram presimulationSeconds("deadfish_presimulation_seconds", "time spent presimulating a fresh world before a match",
+	{0.5, 1, 2.5, 5, 10, 30});
+Counter raycasts("deadfish_raycasts_total", "rays cast for line of sight checks");
+Histogram raycastsPerTick("deadfish_raycasts_per_tick", "line of sight raycasts made during one tick",
+	{10, 50, 100, 250, 500, 1000, 2500, 5000, 10000});
+Counter visibilityPolygons("deadfish_visibility_polygons_total", "visibility polygons computed for players that looked from somewhere new");
+Counter visibilityCulled("deadfish_visibility_culled_total", "line of sight checks answered by a visibility polygon without a ray");
+Gauge players("deadfish_players", "players in the match");
+Gauge civilians("deadfish_civilians", "civilians in the world");
+Gauge civiliansOnRails("deadfish_civilians_on_rails", "civilians far from every player, moved without physics");
+Counter civilianStuck("deadfish_civilian_stuck_total", "civilians that barely moved for long enough to look for another way");
+Counter civilianForcedDespawns("deadfish_civilian_forced_despawns_total", "civilians removed because they stayed stuck or found no other way");
+Counter resolutionRaycasts("deadfish_resolution_raycasts_total", "raycasts made by stuck civilians looking for a visible navpoint");
+Counter avoidanceAdjustments("deadfish_avoidance_adjustments_total", "steering velocities changed by local avoidance");
+Gauge inkParticles("deadfish_ink_particles", "ink particles in the world");
+Gauge mobManipulators("deadfish_mob_manipulators", "attractors and dispersors in the world");
+
+LabeledCounter connectionSentBytes("deadfish_connection_sent_bytes_total", "websocket payload bytes sent", "connection");
+LabeledCounter connectionSentMessages("deadfish_connection_sent_messages_total", "websocket messages sent", "connection");
+LabeledCounter connectionReceivedBytes("deadfish_connection_received_bytes_total", "websocket payload bytes received", "connection");
+LabeledCounter connectionReceivedMessages("deadfish_connection_received_messages_total", "websocket messages received", "connection");
+Gauge lockQueueDepth("deadfish_lock_queue_depth", "client messages waiting for the game lock");
+
+}; // metrics
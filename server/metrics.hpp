@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Prometheus-style metrics, rendered in the text exposition format by the http endpoint.
+// Every metric registers itself on construction, so they have to live as long as the process.
+namespace metrics {
+
+struct Metric {
+	Metric(const char* name, const char* help);
+	virtual ~Metric() {}
+	virtual void render(std::ostream& os) const = 0;
+
+	const char* name;
+	const char* help;
+};
+
+struct Counter : public Metric {
+	using Metric::Metric;
+	void inc(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t get() const { return value.load(std::memory_order_relaxed); }
+	void render(std::ostream& os) const override;
+
+private:
+	std::atomic<uint64_t> value{0};
+};
+
+struct Gauge : public Metric {
+	using Metric::Metric;
+	void set(int64_t v) { value.store(v, std::memory_order_relaxed); }
+	void add(int64_t n) { value.fetch_add(n, std::memory_order_relaxed); }
+	void render(std::ostream& os) const override;
+
+private:
+	std::atomic<int64_t> value{0};
+};
+
+// bounds are the upper bounds of the buckets, the +Inf bucket is implicit
+struct Histogram : public Metric {
+	Histogram(const char* name, const char* help, std::vector<double> bounds);
+	void observe(double v);
+	// starts over from zero, for histograms that describe a single match
+	void reset();
+	void render(std::ostream& os) const override;
+
+private:
+	const std::vector<double> bounds;
+	std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+	std::atomic<uint64_t> count{0};
+	std::atomic<double> sum{0};
+};
+
+// a counter split by the value of one label, e.g. per connection
+struct LabeledCounter : public Metric {
+	// the counter of one label value, look it up once and keep it around to count without the lock
+	using Child = std::shared_ptr<std::atomic<uint64_t>>;
+
+	LabeledCounter(const char* name, const char* help, const char* label);
+	Child child(const std::string& labelValue);
+	// stops rendering the label value, e.g. when the connection is gone
+	void remove(const std::string& labelValue);
+	void render(std::ostream& os) const override;
+
+private:
+	const char* label;
+	mutable std::mutex mut;
+	std::map<std::string, Child> values;
+};
+
+// the metrics endpoint, renders every registered metric
+std::string render();
+
+// game thread
+extern Histogram tickSeconds;
+extern Histogram physicsStepSeconds;
+extern Histogram presimulationSeconds;
+extern Counter raycasts;
+extern Histogram raycastsPerTick;
+extern Counter visibilityPolygons;
+extern Counter visibilityCulled;
+extern Gauge players;
+extern Gauge civilians;
+extern Gauge civiliansOnRails;
+extern Counter civilianStuck;
+extern Counter civilianForcedDespawns;
+extern Counter resolutionRaycasts;
+extern Counter avoidanceAdjustments;
+extern Gauge inkParticles;
+extern Gauge mobManipulators;
+
+// websocket thread
+extern LabeledCounter connectionSentBytes;
+extern LabeledCounter connectionSentMessages;
+extern LabeledCounter connectionReceivedBytes;
+extern LabeledCounter connectionReceivedMessages;
+// messages from clients waiting for the game thread to release the game lock
+extern Gauge lockQueueDepth;
+
+}; // metrics
@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/vector_angle.hpp>
@@ -6,6 +9,10 @@
 
 #include "deadfish.hpp"
 #include "game_thread.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+#include "recorder.hpp"
+#include "steering.hpp"
 #include "../common/geometry.hpp"
 
 std::ostream &operator<<(std::ostream &os, glm::vec2 &v)
@@ -26,6 +33,8 @@ float Mob::calculateSpeed() {
 	return WALK_SPEED;
 }
 
+// steering of a single mob, the tick queues the mobs for the batched kernel in steering.hpp instead,
+// this stays as the reference the kernel is benchmarked and checked against
 void Mob::update()
 {
 	float dist = glm::distance(b2g(this->body->GetPosition()), this->targetPosition);
@@ -39,20 +48,16 @@ void Mob::update()
 	// update angle
 	glm::vec2 toTarget = glm::normalize(this->targetPosition - b2g(this->body->GetPosition()));
 	float currentAngle = -glm::orientedAngle(toTarget, glm::vec2(1, 0)) + M_PI / 2;
-	float diff = currentAngle - this->body->GetAngle();
-
-	if (diff < -M_PI)
-		diff += 2 * M_PI;
-	if (diff > M_PI)
-		diff -= 2 * M_PI;
+	// box2d never wraps the body angle, a mob that turned around a few times is many 2pi away
+	float diff = std::remainder(currentAngle - this->body->GetAngle(), (float) (2 * M_PI));
 
 	bool skip = false;
 	auto turnSpeed = TURN_SPEED;
-	if (abs(diff) < ANGULAR_CLOSE * 2)
+	if (std::abs(diff) < ANGULAR_CLOSE * 2)
 	{
 		turnSpeed /= 2.;
 	}
-	if (abs(diff) < ANGULAR_CLOSE)
+	if (std::abs(diff) < ANGULAR_CLOSE)
 	{
 		this->body->SetAngularVelocity(0);
 		skip = true;
@@ -88,6 +93,7 @@ float Player::calculateSpeed() {
 void Player::reset()
 {
 	gameState.b2world->DestroyBody(this->body);
+	this->body = nullptr;
 	for(auto& hspot : gameState.level->hidingspots) {
 		hspot->playersInside.erase(this);
 	}
@@ -133,6 +139,7 @@ void Player::update()
 		this->targetPosition = b2g(this->body->GetPosition());
 		this->reset();
 		this->deathTimeout = DEATH_TIMEOUT;
+		return; // the body is gone until the player respawns
 	}
 	if (this->bombsAffecting > 0)
 		this->killTargetID = 0;
@@ -146,20 +153,20 @@ void Player::update()
 	killTarget = findMobById(this->killTargetID);
 	if (killTarget)
 		this->targetPosition = b2g(killTarget->body->GetPosition());
-	Mob::update();
+	steering::queue(*this);
 }
 
-glm::vec2 randFromCircle(glm::vec2 center, float radius)
+glm::vec2 randFromCircle(glm::vec2 center, float radius, RandomStream& rng)
 {
-	float x = (center.x - radius) + static_cast<float>(rand()) / (static_cast<float>(RAND_MAX / (2 * radius)));
-	float y = (center.y - radius) + static_cast<float>(rand()) / (static_cast<float>(RAND_MAX / (2 * radius)));
+	float x = (center.x - radius) + rng.randFloat() * 2 * radius;
+	float y = (center.y - radius) + rng.randFloat() * 2 * radius;
 	glm::vec2 ret = {x, y};
 	if (glm::distance(ret, center) <= radius)
 		return ret; 
-	return randFromCircle(center, radius);
+	return randFromCircle(center, radius, rng);
 }
 
-void Civilian::collisionResolution() {
+void Civilian::collisionResolution(RandomStream& rng) {
 	std::vector<std::tuple<float, std::string>> navpoints;
 	for (auto& n : gameState.level->navpoints) {
 		auto bpos = g2b(n.second->position);
@@ -172,32 +179,89 @@ void Civilian::collisionResolution() {
 	std::sort(navpoints.begin(), navpoints.end());
 	for (auto& p : navpoints) {
 		auto spawnName = std::get<1>(p);
-		auto& navpoint = gameState.level->navpoints[spawnName];
+		auto& navpoint = gameState.level->navpoints.at(spawnName);
 		auto spawnPos = g2b(navpoint->position);
 
 		// not where we were currently going but somewhere we can go immediately from here
-		if (this->currentNavpoint != spawnName && mobSeePoint(*this, spawnPos, true)) {
+		if (this->currentNavpoint == spawnName)
+			continue;
+		metrics::resolutionRaycasts.inc();
+		if (mobSeePoint(*this, spawnPos, true)) {
 			this->previousNavpoint = "";
-			this->targetPosition = randFromCircle(navpoint->position, navpoint->radius);
-			std::cout << "resolved collision - changed direction\n";
+			this->targetPosition = randFromCircle(navpoint->position, navpoint->radius, rng);
+			LOG_DEBUG("resolved collision - changed direction");
 			return;
 		}
 	}
-	std::cout << "could not resolve collision - DESPAWN\n";
+	LOG_DEBUG("could not resolve collision - DESPAWN");
+	metrics::civilianForcedDespawns.inc();
 	this->toBeDeleted = true;
 }
 
-void Civilian::update()
+// distance to the closest living player, infinity if there is none
+static float nearestPlayerDistance(const b2Vec2& position)
 {
-	std::vector<MobManipulator> seenManips;
+	float nearest = std::numeric_limits<float>::infinity();
+	for (auto& p : gameState.players) {
+		if (p.second->body)
+			nearest = std::min(nearest, b2Distance(position, p.second->body->GetPosition()));
+	}
+	return nearest;
+}
+
+void Civilian::decideOnRails(RandomStream& rng)
+{
+	auto position = b2g(this->body->GetPosition());
+	auto toTarget = this->targetPosition - position;
+	float dist = glm::length(toTarget);
+	if (dist < CLOSE)
+	{
+		if (gameState.level->navpoints.at(this->currentNavpoint)->isspawn)
+			this->toBeDeleted = true;
+		else
+			this->setNextNavpoint(rng);
+		return;
+	}
+	auto direction = toTarget / dist;
+	position += direction * std::min(this->calculateSpeed() / SECOND, dist);
+	this->railsPosition = g2b(position);
+	this->railsAngle = -glm::orientedAngle(direction, glm::vec2(1, 0)) + M_PI / 2;
+	this->railsMove = true;
+}
+
+void Civilian::decide()
+{
+	auto rng = gameState.mobRandom(this->movableID);
+	this->steers = false;
+	this->railsMove = false;
+
+	// civilians no player is near don't need contacts or steering, their bodies are taken out of the
+	// world and they are moved along their navgraph edges until a player comes close again
+	float nearest = nearestPlayerDistance(this->body->GetPosition());
+	if (!this->onRails)
+		this->wantsRails = nearest > CIV_RAILS_RADIUS;
+	else
+		this->wantsRails = nearest >= CIV_RAILS_RADIUS - CIV_RAILS_HYSTERESIS;
+	if (this->wantsRails) {
+		this->decideOnRails(rng);
+		return;
+	}
+	if (this->onRails) {
+		// back to physics, the stuck detection starts over
+		this->lastPos = this->body->GetPosition();
+		this->slowFrames = 0;
+	}
+
+	// only the last manipulator the civilian sees matters
+	MobManipulator* lastSeen = nullptr;
 	for (auto &mIt : gameState.mobManipulators) {
 		auto &m = mIt.second;
 		if (mobSeePoint(*this, f2b(m->pos), true))
-			seenManips.push_back(*m);
+			lastSeen = m.get();
 	}
-	if (seenManips.size() > 0) {
+	if (lastSeen) {
 		this->seenAManip = true;
-		auto last = seenManips.back();
+		auto& last = *lastSeen;
 		if (last.type == FlatBuffGenerated::MobManipulatorType_Attractor)
 			this->targetPosition = f2g(last.pos);
 		else {
@@ -206,22 +270,24 @@ void Civilian::update()
 			toManip.Normalize();
 			this->targetPosition = b2g(this->body->GetPosition() + toManip);
 		}
-		Mob::update();
+		this->steers = true;
 		return;
 	} else if (this->seenAManip) {
-		this->collisionResolution();
+		this->collisionResolution(rng);
 		this->seenAManip = false;
 	}
 
 	if (this->bombsAffecting == 0 && b2Distance(this->body->GetPosition(), this->lastPos) < (WALK_SPEED/20) * 0.4f) {
 		slowFrames++;
 		if (slowFrames == CIV_SLOW_FRAMES) {
-			this->collisionResolution();
+			metrics::civilianStuck.inc();
+			this->collisionResolution(rng);
 			return;
 		}
 		if (slowFrames == CIV_RESET_FRAMES) {
+			metrics::civilianForcedDespawns.inc();
 			this->toBeDeleted = true;
-			std::cout << "collision resolution DELETED CIVILIAN\n";
+			LOG_DEBUG("collision resolution DELETED CIVILIAN");
 		}
 	} else
 		slowFrames = 0;
@@ -230,36 +296,71 @@ void Civilian::update()
 	if (dist < CLOSE)
 	{
 		// the civilian reached his destination
-		if (gameState.level->navpoints[this->currentNavpoint]->isspawn)
+		if (gameState.level->navpoints.at(this->currentNavpoint)->isspawn)
 		{
 			// we arrived at spawn, despawn
 			this->toBeDeleted = true;
 			return;
 		}
-		this->setNextNavpoint();
+		this->setNextNavpoint(rng);
 	}
-	Mob::update();
+	this->steers = true;
 }
 
-void Civilian::setNextNavpoint()
+void Civilian::apply()
 {
-	auto &spawn = gameState.level->navpoints[this->currentNavpoint];
-	auto neighbors = spawn->neighbors;
-	std::vector<std::string>::iterator toDelete = neighbors.end();
-	for (auto it = neighbors.begin(); it != neighbors.end(); it++)
-	{
-		if (*it == this->previousNavpoint)
-		{
-			toDelete = it;
-			break;
+	if (this->wantsRails != this->onRails) {
+		this->onRails = this->wantsRails;
+		if (this->onRails) {
+			this->body->SetLinearVelocity({0, 0});
+			this->body->SetAngularVelocity(0);
 		}
+		this->body->SetActive(!this->onRails);
 	}
-	if (toDelete != neighbors.end())
-		neighbors.erase(toDelete);
+	if (this->railsMove)
+		this->body->SetTransform(this->railsPosition, this->railsAngle);
+	if (this->steers)
+		steering::queue(*this, true);
+}
+
+void Civilian::recycle()
+{
+	this->toBeDeleted = false;
+	this->species = 0;
+	this->state = MobState::WALKING;
+	this->targetPosition = {0, 0};
+	this->bombsAffecting = 0;
+	this->currentNavpoint.clear();
+	this->previousNavpoint.clear();
+	this->slowFrames = 0;
+	this->lastPos = {0, 0};
+	this->seenAManip = false;
+	this->onRails = false;
+	this->wantsRails = false;
+	this->steers = false;
+	this->railsMove = false;
+}
+
+void Civilian::update()
+{
+	this->decide();
+	this->apply();
+}
+
+void Civilian::setNextNavpoint(RandomStream& rng)
+{
+	auto &spawn = gameState.level->navpoints.at(this->currentNavpoint);
+	auto &neighbors = spawn->neighbors;
+	// pick any neighbor but the one we came from, without copying the list
+	auto previous = std::find(neighbors.begin(), neighbors.end(), this->previousNavpoint);
+	size_t candidates = neighbors.size() - (previous != neighbors.end() ? 1 : 0);
+	size_t pick = rng.randInt(candidates);
+	if (previous != neighbors.end() && pick >= (size_t) (previous - neighbors.begin()))
+		pick++;
 	this->previousNavpoint = this->currentNavpoint;
-	this->currentNavpoint = neighbors[rand() % neighbors.size()];
-	auto& targetPoint = gameState.level->navpoints[this->currentNavpoint];
-	this->targetPosition = randFromCircle(targetPoint->position, targetPoint->radius);
+	this->currentNavpoint = neighbors[pick];
+	auto& targetPoint = gameState.level->navpoints.at(this->currentNavpoint);
+	this->targetPosition = randFromCircle(targetPoint->position, targetPoint->radius, rng);
 }
 
 void Player::handleCollision(Collideable &other)
@@ -325,31 +426,31 @@ KillcountMechanicsInfo handleKillcountMechanics(Player& killer, Player& victim)
 
 	// killing spree
 	if (killer.killingSpreeCounter >= KILLING_SPREE_THRESHOLD) {
-		std::cout << killer.name << " KILLING SPREE " << killer.killingSpreeCounter << std::endl;
+		LOG_INFO("%s KILLING SPREE %d", killer.name.c_str(), killer.killingSpreeCounter);
 		killer.points += killer.killingSpreeCounter * KILLING_SPREE_REWARD;
 		ret.killing_spree = killer.killingSpreeCounter;
 	}
 	// shutdown
 	if (victim.killingSpreeCounter >= KILLING_SPREE_THRESHOLD) {
-		std::cout << killer.name << " ended " << victim.name << "'s killing spree" << std::endl;
+		LOG_INFO("%s ended %s's killing spree", killer.name.c_str(), victim.name.c_str());
 		killer.points += victim.killingSpreeCounter * SHUTDOWN_REWARD;
 		ret.shutdown = victim.killingSpreeCounter;
 	}
 	// domination
 	if (killer.dominationCounters[victim.playerID] >= DOMINATION_THRESHOLD) {
-		std::cout << killer.name << " is dominating " << victim.name << " [" << killer.dominationCounters[victim.playerID] << "]" << std::endl;
+		LOG_INFO("%s is dominating %s [%d]", killer.name.c_str(), victim.name.c_str(), killer.dominationCounters[victim.playerID]);
 		killer.points += killer.dominationCounters[victim.playerID] * DOMINATION_REWARD;
 		ret.domination = killer.dominationCounters[victim.playerID];
 	}
 	// revenge
 	if (victim.dominationCounters[killer.playerID] >= DOMINATION_THRESHOLD) {
-		std::cout << killer.name << " got revenge on " << victim.name << std::endl;
+		LOG_INFO("%s got revenge on %s", killer.name.c_str(), victim.name.c_str());
 		killer.points += victim.dominationCounters[killer.playerID] * REVENGE_REWARD;
 		ret.revenge = victim.dominationCounters[killer.playerID];
 	}
 	// comeback
 	if (killer.comebackCounter >= COMEBACK_THRESHOLD) {
-		std::cout << killer.name << " gets a comeback [" << killer.comebackCounter << std::endl;
+		LOG_INFO("%s gets a comeback [%d]", killer.name.c_str(), killer.comebackCounter);
 		killer.points += killer.comebackCounter * COMEBACK_REWARD;
 		ret.comeback = killer.comebackCounter;
 	}
@@ -367,7 +468,7 @@ KillcountMechanicsInfo handleKillcountMechanics(Player& killer, Player& victim)
 void handleGoldfishKill(Player& killer) {
 	if (killer.skills.size() == MAX_SKILLS)
 		return;
-	uint16_t skill = rand() % (uint16_t) Skills::SKILLS_MAX;
+	uint16_t skill = gameState.randInt((uint16_t) Skills::SKILLS_MAX);
 	killer.skills.push_back(skill);
 	killer.sendSkillBarUpdate();
 }
@@ -376,6 +477,7 @@ void Civilian::handleKill(Player& killer) {
 	if (killer.isDead())
 		return;
 	this->toBeDeleted = true;
+	recordKill(killer.movableID, this->movableID);
 
 	// send the deathreport killed npc message
 	flatbuffers::FlatBufferBuilder builder;
@@ -406,6 +508,7 @@ void Player::handleKill(Player& killer) {
 
 	auto mmInfo = handleKillcountMechanics(killer, *this);
 	this->toBeDeleted = true;
+	recordKill(killer.movableID, this->movableID);
 	killer.points += KILL_REWARD;
 
 	// send the deathreport message
@@ -424,7 +527,7 @@ void Player::handleKill(Player& killer) {
 		mmInfo.comeback);
 	auto data = makeServerMessage(builder, FlatBuffGenerated::ServerMessageUnion_DeathReport, ev.Union());
 	sendToAll(data);
-	std::cout << "[ " << killer.playerKillCounters[this->playerID] << " : " << this->playerKillCounters[killer.playerID] << "]\n";
+	LOG_INFO("[ %d : %d]", killer.playerKillCounters[this->playerID], this->playerKillCounters[killer.playerID]);
 
 	sendHighscores();
 }
@@ -438,5 +541,5 @@ void Player::sendSkillBarUpdate() {
 	auto skills = builder.CreateVector(this->skills);
 	auto ev = FlatBuffGenerated::CreateSkillBarUpdate(builder, skills);
 	sendServerMessage(*this, builder, FlatBuffGenerated::ServerMessageUnion_SkillBarUpdate, ev.Union());
-	std::cout << "updated skills of player " << this->name << "\n";
+	LOG_DEBUG("updated skills of player %s", this->name.c_str());
 }
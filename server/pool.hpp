@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+// Keeps removed entities together with their bodies so spawning can reuse them instead of creating
+// new bodies and fixtures. Entities removed during a tick are released, parkReleased then takes all
+// of their bodies out of the world at once at the end of the tick and acquire hands them out again.
+template<typename T>
+class EntityPool {
+public:
+	// nullptr when nothing is parked, the caller creates a new entity then
+	std::unique_ptr<T> acquire() {
+		if (parked.empty())
+			return nullptr;
+		auto entity = std::move(parked.back());
+		parked.pop_back();
+		return entity;
+	}
+
+	void release(std::unique_ptr<T> entity) {
+		released.push_back(std::move(entity));
+	}
+
+	// deactivating a body ends its contacts, the contact listener skips entities marked toBeDeleted
+	// so the mark is cleared first to let the other side of each contact learn that it ended
+	void parkReleased() {
+		for (auto& entity : released) {
+			entity->toBeDeleted = false;
+			entity->body->SetActive(false);
+			parked.push_back(std::move(entity));
+		}
+		released.clear();
+	}
+
+	size_t parkedCount() const { return parked.size(); }
+
+private:
+	std::vector<std::unique_ptr<T>> parked;
+	std::vector<std::unique_ptr<T>> released;
+};
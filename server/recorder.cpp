@@ -0,0 +1,442 @@
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "../common/hash.hpp"
+#include "../common/recording.hpp"
+
+#include "recorder.hpp"
+#include "deadfish.hpp"
+#include "ink.hpp"
+#include "level_loader.hpp"
+#include "log.hpp"
+
+const uint32_t KEYFRAME_INTERVAL = 5 * SECOND;
+// a disk that can't keep up drops frames rather than growing the queue without bound
+const size_t MAX_QUEUED_FRAMES = 10 * SECOND;
+
+struct QueuedFrame {
+	std::vector<uint8_t> data;
+	uint32_t tick;
+	bool keyframe;
+};
+
+// game thread side
+static bool recording = false;
+static flatbuffers::FlatBufferBuilder frameBuilder(16 * 1024);
+static uint32_t framesSinceKeyframe = 0;
+static std::vector<FlatBuffGenerated::RecordedKill> pendingKills;
+static bool droppingFrames = false;
+
+struct RecordedMobState {
+	FlatBuffGenerated::MovableComponent movable;
+	MobState state;
+	uint16_t species;
+	bool seen;
+};
+// what the frames written so far say about each mob
+static std::unordered_map<uint16_t, RecordedMobState> recordedMobs;
+
+// shared with the writer
+static std::mutex queueMut;
+static std::condition_variable queueCond;
+static std::deque<QueuedFrame> queue;
+static std::vector<std::vector<uint8_t>> spareBuffers;
+static bool stopping = false;
+
+// writer side
+static std::ofstream file;
+// never destroyed, the process may exit in the middle of a match
+static std::thread* writer = nullptr;
+static std::vector<RecordingIndexEntry> seekIndex;
+static uint64_t fileOffset = 0;
+static bool writeFailed = false;
+
+static void writeFrames()
+{
+	static const char padding[RECORDING_ALIGNMENT] = {};
+	std::unique_lock<std::mutex> lock(queueMut);
+	while (true) {
+		queueCond.wait(lock, []{ return stopping || !queue.empty(); });
+		if (queue.empty())
+			return;
+		auto frame = std::move(queue.front());
+		queue.pop_front();
+		lock.unlock();
+
+		if (!writeFailed) {
+			if (frame.keyframe)
+				seekIndex.push_back({frame.tick, 0, fileOffset});
+			seekIndex.back().frames++;
+			file.write((const char*) frame.data.data(), frame.data.size());
+			size_t padded = (frame.data.size() + RECORDING_ALIGNMENT - 1) / RECORDING_ALIGNMENT * RECORDING_ALIGNMENT;
+			file.write(padding, padded - frame.data.size());
+			fileOffset += padded;
+			if (!file) {
+				// the frames written so far can still be walked, they just have no index
+				LOG_ERROR("could not write the recording, dropping the rest of the match");
+				writeFailed = true;
+			}
+		}
+
+		lock.lock();
+		spareBuffers.push_back(std::move(frame.data));
+	}
+}
+
+static RecordingHeader makeHeader()
+{
+	RecordingHeader header = {};
+	memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+	header.version = RECORDING_VERSION;
+	header.tickRate = SECOND;
+	header.levelHash = gameState.level->file->levelHash;
+	header.indexOffset = 0;
+	header.indexEntries = 0;
+	return header;
+}
+
+void recordingStart()
+{
+	if (!gameState.options.count("recorddir"))
+		return;
+	// with --rematch the matches of the process share the seed
+	static uint32_t matches = 0;
+	auto path = gameState.options["recorddir"].as<std::string>() + "/" + std::to_string(gameState.seed)
+		+ (matches ? "-" + std::to_string(matches) : "") + ".dfrec";
+	matches++;
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		LOG_ERROR("could not open recording %s", path.c_str());
+		return;
+	}
+	LOG_INFO("recording the match to %s", path.c_str());
+
+	auto header = makeHeader();
+	file.write((const char*) &header, sizeof(header));
+	if (!file) {
+		LOG_ERROR("could not write recording %s", path.c_str());
+		file.close();
+		return;
+	}
+	fileOffset = sizeof(header);
+	seekIndex.clear();
+	writeFailed = false;
+	recordedMobs.clear();
+	pendingKills.clear();
+	framesSinceKeyframe = 0;
+	droppingFrames = false;
+	stopping = false;
+	recording = true;
+	writer = new std::thread(writeFrames);
+}
+
+void recordKill(uint16_t killerID, uint16_t victimID)
+{
+	if (recording)
+		pendingKills.emplace_back(killerID, victimID);
+}
+
+static bool mobChanged(const RecordedMobState& last, const FlatBuffGenerated::MovableComponent& movable, Mob& m)
+{
+	return last.movable.pos().x() != movable.pos().x() || last.movable.pos().y() != movable.pos().y()
+		|| last.movable.angle() != movable.angle() || last.state != m.state || last.species != m.species;
+}
+
+void recordFrame()
+{
+	if (!recording)
+		return;
+	bool full;
+	{
+		std::lock_guard<std::mutex> lock(queueMut);
+		full = queue.size() >= MAX_QUEUED_FRAMES;
+	}
+	if (full) {
+		// the next frame after the gap has to be a keyframe, the mobs it would be a delta of were
+		// never written. The kills wait for it
+		if (!droppingFrames)
+			LOG_WARN("the recording fell %zu frames behind, dropping frames", MAX_QUEUED_FRAMES);
+		droppingFrames = true;
+		framesSinceKeyframe = 0;
+		return;
+	}
+	droppingFrames = false;
+	bool keyframe = framesSinceKeyframe == 0;
+	framesSinceKeyframe = (framesSinceKeyframe + 1) % KEYFRAME_INTERVAL;
+
+	auto& builder = frameBuilder;
+	builder.Clear();
+
+	// reused from frame to frame, a recording must not allocate on every tick
+	static std::vector<flatbuffers::Offset<FlatBuffGenerated::RecordedMob>> mobs;
+	static std::vector<uint16_t> removedMobs;
+	static std::vector<FlatBuffGenerated::MovableComponent> inkParticles;
+	static std::vector<flatbuffers::Offset<FlatBuffGenerated::MobManipulator>> manipulators;
+	static std::vector<flatbuffers::Offset<FlatBuffGenerated::RecordedPlayer>> players;
+	mobs.clear();
+	removedMobs.clear();
+	inkParticles.clear();
+	manipulators.clear();
+	players.clear();
+
+	for (auto& r : recordedMobs)
+		r.second.seen = false;
+	auto recordMob = [&](Mob& m){
+		if (!m.body)
+			return;
+		FlatBuffGenerated::MovableComponent movable(b2f(m.body->GetPosition()), m.movableID, m.body->GetAngle());
+		auto it = recordedMobs.find(m.movableID);
+		if (it != recordedMobs.end()) {
+			it->second.seen = true;
+			if (!keyframe && !mobChanged(it->second, movable, m))
+				return;
+			it->second = {movable, m.state, m.species, true};
+		} else {
+			recordedMobs.emplace(m.movableID, RecordedMobState{movable, m.state, m.species, true});
+		}
+		mobs.push_back(FlatBuffGenerated::CreateRecordedMob(builder, &movable,
+			(FlatBuffGenerated::MobState) m.state, m.species));
+	};
+	iterateOverMovableMap(gameState.players, [&](Player& p){ recordMob(p); });
+	iterateOverMovableMap(gameState.civilians, [&](Civilian& c){ recordMob(c); });
+
+	for (auto it = recordedMobs.begin(); it != recordedMobs.end();) {
+		if (it->second.seen) {
+			++it;
+			continue;
+		}
+		removedMobs.push_back(it->first);
+		it = recordedMobs.erase(it);
+	}
+
+	for (size_t i = 0; i < ink::particles.size(); i++) {
+		inkParticles.emplace_back(FlatBuffGenerated::Vec2(ink::particles.x[i], ink::particles.y[i]),
+			ink::particles.movableID[i], 0);
+	}
+
+	iterateOverMovableMap(gameState.mobManipulators,
+		[&](MobManipulator& m){
+			FlatBuffGenerated::MovableComponent movable(m.pos, m.movableID, m.angle);
+			manipulators.push_back(FlatBuffGenerated::CreateMobManipulator(builder, &movable, m.type));
+		}
+	);
+
+	iterateOverMovableMap(gameState.players,
+		[&](Player& p){
+			players.push_back(FlatBuffGenerated::CreateRecordedPlayer(builder, p.movableID, p.playerID, p.points, p.isDead()));
+		}
+	);
+
+	auto frame = FlatBuffGenerated::CreateRecordingFrame(builder,
+		gameState.tick,
+		keyframe,
+		gameState.roundTimer,
+		builder.CreateVector(mobs),
+		builder.CreateVector(removedMobs),
+		builder.CreateVectorOfStructs(inkParticles),
+		builder.CreateVector(manipulators),
+		builder.CreateVector(players),
+		builder.CreateVectorOfStructs(pendingKills));
+	builder.FinishSizePrefixed(frame);
+	pendingKills.clear();
+
+	{
+		std::lock_guard<std::mutex> lock(queueMut);
+		std::vector<uint8_t> data;
+		if (!spareBuffers.empty()) {
+			data = std::move(spareBuffers.back());
+			spareBuffers.pop_back();
+		}
+		data.assign(builder.GetBufferPointer(), builder.GetBufferPointer() + builder.GetSize());
+		queue.push_back({std::move(data), gameState.tick, keyframe});
+	}
+	queueCond.notify_one();
+}
+
+void recordingEnd()
+{
+	if (!recording)
+		return;
+	recording = false;
+	{
+		std::lock_guard<std::mutex> lock(queueMut);
+		stopping = true;
+	}
+	queueCond.notify_one();
+	writer->join();
+	delete writer;
+	writer = nullptr;
+
+	if (writeFailed) {
+		file.close();
+		return;
+	}
+	// the frames are all written, put the seek index behind them and point the header to it
+	auto header = makeHeader();
+	header.indexOffset = fileOffset;
+	header.indexEntries = seekIndex.size();
+	file.write((const char*) seekIndex.data(), seekIndex.size() * sizeof(RecordingIndexEntry));
+	file.seekp(0);
+	file.write((const char*) &header, sizeof(header));
+	file.close();
+	if (!file) {
+		LOG_ERROR("could not write the seek index of the recording");
+		return;
+	}
+	LOG_INFO("recording written, %u chunks", header.indexEntries);
+}
+
+typedef std::map<uint16_t, RecordedMobState> RecordedMobs;
+
+static uint64_t mobsChecksum(const RecordedMobs& mobs)
+{
+	uint64_t hash = contentHash(nullptr, 0);
+	for (auto& m : mobs) {
+		float values[3] = { m.second.movable.pos().x(), m.second.movable.pos().y(), m.second.movable.angle() };
+		hash = contentHash(&m.first, sizeof(m.first), hash);
+		hash = contentHash(values, sizeof(values), hash);
+		hash = contentHash(&m.second.state, sizeof(m.second.state), hash);
+		hash = contentHash(&m.second.species, sizeof(m.second.species), hash);
+	}
+	return hash;
+}
+
+uint64_t recordedMobsChecksum()
+{
+	// straight from the world, not from what the recorder thinks it wrote
+	RecordedMobs mobs;
+	auto addMob = [&](Mob& m){
+		if (!m.body)
+			return;
+		FlatBuffGenerated::MovableComponent movable(b2f(m.body->GetPosition()), m.movableID, m.body->GetAngle());
+		mobs[m.movableID] = {movable, m.state, m.species, true};
+	};
+	iterateOverMovableMap(gameState.players, [&](Player& p){ addMob(p); });
+	iterateOverMovableMap(gameState.civilians, [&](Civilian& c){ addMob(c); });
+	return mobsChecksum(mobs);
+}
+
+static void applyFrame(RecordedMobs& mobs, const FlatBuffGenerated::RecordingFrame* frame)
+{
+	if (frame->keyframe())
+		mobs.clear();
+	if (frame->removedMobs()) {
+		for (auto id : *frame->removedMobs())
+			mobs.erase(id);
+	}
+	if (frame->mobs()) {
+		for (auto m : *frame->mobs())
+			mobs[m->movable()->ID()] = {*m->movable(), (MobState) m->state(), m->species(), true};
+	}
+}
+
+int verifyRecording(const std::string& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		std::cout << "could not open recording " << path << "\n";
+		return 1;
+	}
+	std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	// the frames are only aligned relative to the file, the buffer has to be aligned as well
+	std::vector<uint64_t> storage((bytes.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+	memcpy(storage.data(), bytes.data(), bytes.size());
+	auto data = (const uint8_t*) storage.data();
+	size_t size = bytes.size();
+
+	RecordingHeader header;
+	if (size < sizeof(header)) {
+		std::cout << "recording " << path << " has no header\n";
+		return 1;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (!recordingHeaderValid(header)) {
+		std::cout << "recording " << path << " is not a version " << RECORDING_VERSION << " recording\n";
+		return 1;
+	}
+	if (header.indexOffset == 0 || header.indexOffset + header.indexEntries * sizeof(RecordingIndexEntry) > size) {
+		std::cout << "recording " << path << " has no seek index\n";
+		return 1;
+	}
+	auto index = (const RecordingIndexEntry*) (data + header.indexOffset);
+
+	// play the whole file once, remembering where every tick is and what it holds
+	std::map<uint32_t, uint64_t> played;
+	std::map<uint32_t, size_t> offsets;
+	RecordedMobs mobs;
+	size_t offset = sizeof(header);
+	uint32_t chunk = 0, framesInChunk = 0;
+	while (offset < header.indexOffset) {
+		if (offset % RECORDING_ALIGNMENT != 0 || offset + sizeof(flatbuffers::uoffset_t) > header.indexOffset) {
+			std::cout << "frame at " << offset << " is misaligned or cut off\n";
+			return 1;
+		}
+		size_t frameSize = sizeof(flatbuffers::uoffset_t) + flatbuffers::GetPrefixedSize(data + offset);
+		flatbuffers::Verifier verifier(data + offset, std::min(frameSize, (size_t) header.indexOffset - offset));
+		if (!verifier.VerifySizePrefixedBuffer<FlatBuffGenerated::RecordingFrame>(nullptr)) {
+			std::cout << "frame at " << offset << " is corrupted\n";
+			return 1;
+		}
+		auto frame = flatbuffers::GetSizePrefixedRoot<FlatBuffGenerated::RecordingFrame>(data + offset);
+		if (frame->keyframe()) {
+			if (chunk > 0 && index[chunk - 1].frames != framesInChunk) {
+				std::cout << "chunk " << chunk - 1 << " has " << framesInChunk << " frames, the index says "
+					<< index[chunk - 1].frames << "\n";
+				return 1;
+			}
+			if (chunk == header.indexEntries || index[chunk].offset != offset || index[chunk].firstTick != frame->tick()) {
+				std::cout << "keyframe of tick " << frame->tick() << " is not in the seek index\n";
+				return 1;
+			}
+			chunk++;
+			framesInChunk = 0;
+		} else if (chunk == 0) {
+			std::cout << "recording " << path << " does not start with a keyframe\n";
+			return 1;
+		}
+		framesInChunk++;
+		applyFrame(mobs, frame);
+		played[frame->tick()] = mobsChecksum(mobs);
+		offsets[frame->tick()] = offset;
+		offset += (frameSize + RECORDING_ALIGNMENT - 1) / RECORDING_ALIGNMENT * RECORDING_ALIGNMENT;
+	}
+	if (chunk != header.indexEntries || (chunk > 0 && index[chunk - 1].frames != framesInChunk)) {
+		std::cout << "the seek index does not match the frames of " << path << "\n";
+		return 1;
+	}
+
+	// then seek to every tick through the index and rebuild it from its keyframe
+	for (auto& t : played) {
+		auto entry = findRecordingChunk(index, header.indexEntries, t.first);
+		if (!entry) {
+			std::cout << "tick " << t.first << " is not in the seek index\n";
+			return 1;
+		}
+		mobs.clear();
+		for (size_t o = entry->offset; o <= offsets[t.first];) {
+			auto frame = flatbuffers::GetSizePrefixedRoot<FlatBuffGenerated::RecordingFrame>(data + o);
+			applyFrame(mobs, frame);
+			size_t frameSize = sizeof(flatbuffers::uoffset_t) + flatbuffers::GetPrefixedSize(data + o);
+			o += (frameSize + RECORDING_ALIGNMENT - 1) / RECORDING_ALIGNMENT * RECORDING_ALIGNMENT;
+		}
+		if (mobsChecksum(mobs) != t.second) {
+			std::cout << "seeking to tick " << t.first << " rebuilt different mobs than playing the recording\n";
+			return 1;
+		}
+	}
+
+	if (played.empty()) {
+		std::cout << "recording " << path << " has no frames\n";
+		return 1;
+	}
+	std::cout << "recording: " << played.size() << " frames in " << header.indexEntries << " chunks, tick "
+		<< played.rbegin()->first << " mobs checksum " << played.rbegin()->second << "\n";
+	return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Omniscient recording of the match into a seekable file, see common/recording.hpp for the layout.
+// Frames are built on the game thread and written out by a background thread so the game loop never
+// waits on the disk. All functions expect the game lock, they do nothing unless a recording is running.
+
+// starts recording the match to <recorddir>/<seed>.dfrec, later matches of a --rematch server get a -<n> suffix
+void recordingStart();
+// after every tick of the game loop
+void recordFrame();
+void recordKill(uint16_t killerID, uint16_t victimID);
+// writes the seek index and waits until everything is on disk
+void recordingEnd();
+
+// of the mobs of the world as a recording holds them, to compare against verifyRecording
+uint64_t recordedMobsChecksum();
+// plays a recording from the start and seeks to each of its ticks through the index, both have to
+// rebuild the same mobs. Prints the checksum of the last tick, returns the process exit code
+int verifyRecording(const std::string& path);
@@ -0,0 +1,499 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "sight.hpp"
+#include "level_loader.hpp"
+
+namespace sight {
+
+#if defined(__AVX__)
+const char* const kernel = "avx";
+const size_t LANES = 8;
+#elif defined(__SSE2__)
+const char* const kernel = "sse2";
+const size_t LANES = 4;
+#else
+const char* const kernel = "scalar";
+const size_t LANES = 1;
+#endif
+
+// most masks are a few meters across, a cell holds a handful of edges
+const float CELL = 4.f;
+const uint32_t BENCH_ITERATIONS = 10;
+const float BENCH_MIN_RAY = 0.5f;
+const float BENCH_MAX_RAY = 20.f;
+const uint32_t BENCH_VIEWS = 50;
+
+// stops rays crossing it from right to left, that is entering a counter-clockwise polygon, edges
+// that stop rays either way are added once in each direction
+struct Edge {
+	b2Vec2 from, to;
+};
+
+struct Ray {
+	b2Vec2 from, delta;
+	float maxFraction;
+};
+
+class OccluderGrid {
+public:
+	void build(const std::vector<Edge>& edges, const std::vector<b2Fixture*>& circles);
+	bool blocked(const Ray& ray) const;
+
+	float originX = 0, originY = 0;
+	int width = 0, height = 0;
+
+private:
+	bool blockedInCell(const Ray& ray, size_t cell) const;
+	bool edgesHit(const Ray& ray, size_t begin, size_t end) const;
+
+	int cellX(float x) const {
+		return std::min(width - 1, std::max(0, (int) std::floor((x - originX) / CELL)));
+	}
+	int cellY(float y) const {
+		return std::min(height - 1, std::max(0, (int) std::floor((y - originY) / CELL)));
+	}
+
+	// the edges of a cell are edgeStart[cell] to edgeStart[cell + 1], padded to whole registers
+	// with zero length edges, an edge crossing several cells is in each of them
+	std::vector<uint32_t> edgeStart;
+	std::vector<float> x, y, ex, ey;
+	// circles are rare, box2d casts the ray against them
+	std::vector<uint32_t> circleStart;
+	std::vector<b2Fixture*> circles;
+};
+
+static OccluderGrid masks;
+static OccluderGrid walls;
+static std::vector<HidingSpot*> hidingSpots;
+static fov::mesh masksMesh;
+
+void OccluderGrid::build(const std::vector<Edge>& edges, const std::vector<b2Fixture*>& circleFixtures)
+{
+	*this = OccluderGrid();
+	std::vector<b2AABB> boxes;
+	for (auto& e : edges) {
+		b2AABB box;
+		box.lowerBound = b2Min(e.from, e.to);
+		box.upperBound = b2Max(e.from, e.to);
+		boxes.push_back(box);
+	}
+	for (auto f : circleFixtures)
+		boxes.push_back(f->GetAABB(0));
+	if (boxes.empty())
+		return;
+
+	b2AABB bounds = boxes.front();
+	for (auto& box : boxes)
+		bounds.Combine(box);
+	originX = bounds.lowerBound.x;
+	originY = bounds.lowerBound.y;
+	width = (int) std::ceil((bounds.upperBound.x - bounds.lowerBound.x) / CELL) + 1;
+	height = (int) std::ceil((bounds.upperBound.y - bounds.lowerBound.y) / CELL) + 1;
+
+	std::vector<std::vector<uint32_t>> cellItems(width * height);
+	for (uint32_t i = 0; i < boxes.size(); i++) {
+		for (int cy = cellY(boxes[i].lowerBound.y); cy <= cellY(boxes[i].upperBound.y); cy++) {
+			for (int cx = cellX(boxes[i].lowerBound.x); cx <= cellX(boxes[i].upperBound.x); cx++)
+				cellItems[cy * width + cx].push_back(i);
+		}
+	}
+
+	edgeStart.push_back(0);
+	circleStart.push_back(0);
+	for (auto& items : cellItems) {
+		for (auto i : items) {
+			if (i >= edges.size()) {
+				circles.push_back(circleFixtures[i - edges.size()]);
+				continue;
+			}
+			x.push_back(edges[i].from.x);
+			y.push_back(edges[i].from.y);
+			ex.push_back(edges[i].to.x - edges[i].from.x);
+			ey.push_back(edges[i].to.y - edges[i].from.y);
+		}
+		while (x.size() % LANES != 0) {
+			x.push_back(0);
+			y.push_back(0);
+			ex.push_back(0);
+			ey.push_back(0);
+		}
+		edgeStart.push_back(x.size());
+		circleStart.push_back(circles.size());
+	}
+}
+
+// With w = edge start - ray start and denom = cross(delta, edge), the ray hits the edge at
+// t = cross(w, edge) / denom along itself and s = cross(w, delta) / denom along the edge. denom < 0
+// means the ray crosses from right to left, then 0 <= t <= maxFraction and 0 <= s <= 1 come out
+// as comparisons without dividing. Zero length padding has denom 0 and never hits.
+#if defined(__AVX__)
+bool OccluderGrid::edgesHit(const Ray& ray, size_t begin, size_t end) const
+{
+	const __m256 ox = _mm256_set1_ps(ray.from.x);
+	const __m256 oy = _mm256_set1_ps(ray.from.y);
+	const __m256 dx = _mm256_set1_ps(ray.delta.x);
+	const __m256 dy = _mm256_set1_ps(ray.delta.y);
+	const __m256 maxFraction = _mm256_set1_ps(ray.maxFraction);
+	const __m256 zero = _mm256_setzero_ps();
+	for (size_t i = begin; i < end; i += 8) {
+		__m256 edgeX = _mm256_loadu_ps(&ex[i]);
+		__m256 edgeY = _mm256_loadu_ps(&ey[i]);
+		__m256 wx = _mm256_sub_ps(_mm256_loadu_ps(&x[i]), ox);
+		__m256 wy = _mm256_sub_ps(_mm256_loadu_ps(&y[i]), oy);
+		__m256 denom = _mm256_sub_ps(_mm256_mul_ps(dx, edgeY), _mm256_mul_ps(dy, edgeX));
+		__m256 t = _mm256_sub_ps(_mm256_mul_ps(wx, edgeY), _mm256_mul_ps(wy, edgeX));
+		__m256 s = _mm256_sub_ps(_mm256_mul_ps(wx, dy), _mm256_mul_ps(wy, dx));
+		__m256 hit = _mm256_cmp_ps(denom, zero, _CMP_LT_OQ);
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, zero, _CMP_LE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, _mm256_mul_ps(maxFraction, denom), _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(s, zero, _CMP_LE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(s, denom, _CMP_GE_OQ));
+		if (_mm256_movemask_ps(hit))
+			return true;
+	}
+	return false;
+}
+#elif defined(__SSE2__)
+bool OccluderGrid::edgesHit(const Ray& ray, size_t begin, size_t end) const
+{
+	const __m128 ox = _mm_set1_ps(ray.from.x);
+	const __m128 oy = _mm_set1_ps(ray.from.y);
+	const __m128 dx = _mm_set1_ps(ray.delta.x);
+	const __m128 dy = _mm_set1_ps(ray.delta.y);
+	const __m128 maxFraction = _mm_set1_ps(ray.maxFraction);
+	const __m128 zero = _mm_setzero_ps();
+	for (size_t i = begin; i < end; i += 4) {
+		__m128 edgeX = _mm_loadu_ps(&ex[i]);
+		__m128 edgeY = _mm_loadu_ps(&ey[i]);
+		__m128 wx = _mm_sub_ps(_mm_loadu_ps(&x[i]), ox);
+		__m128 wy = _mm_sub_ps(_mm_loadu_ps(&y[i]), oy);
+		__m128 denom = _mm_sub_ps(_mm_mul_ps(dx, edgeY), _mm_mul_ps(dy, edgeX));
+		__m128 t = _mm_sub_ps(_mm_mul_ps(wx, edgeY), _mm_mul_ps(wy, edgeX));
+		__m128 s = _mm_sub_ps(_mm_mul_ps(wx, dy), _mm_mul_ps(wy, dx));
+		__m128 hit = _mm_cmplt_ps(denom, zero);
+		hit = _mm_and_ps(hit, _mm_cmple_ps(t, zero));
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(t, _mm_mul_ps(maxFraction, denom)));
+		hit = _mm_and_ps(hit, _mm_cmple_ps(s, zero));
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(s, denom));
+		if (_mm_movemask_ps(hit))
+			return true;
+	}
+	return false;
+}
+#else
+bool OccluderGrid::edgesHit(const Ray& ray, size_t begin, size_t end) const
+{
+	for (size_t i = begin; i < end; i++) {
+		float wx = x[i] - ray.from.x, wy = y[i] - ray.from.y;
+		float denom = ray.delta.x * ey[i] - ray.delta.y * ex[i];
+		float t = wx * ey[i] - wy * ex[i];
+		float s = wx * ray.delta.y - wy * ray.delta.x;
+		if (denom < 0 && t <= 0 && t >= ray.maxFraction * denom && s <= 0 && s >= denom)
+			return true;
+	}
+	return false;
+}
+#endif
+
+bool OccluderGrid::blockedInCell(const Ray& ray, size_t cell) const
+{
+	if (circleStart[cell] != circleStart[cell + 1]) {
+		b2RayCastInput input;
+		input.p1 = ray.from;
+		input.p2 = ray.from + ray.delta;
+		input.maxFraction = ray.maxFraction;
+		b2RayCastOutput output;
+		for (uint32_t i = circleStart[cell]; i < circleStart[cell + 1]; i++) {
+			if (circles[i]->RayCast(&output, input, 0))
+				return true;
+		}
+	}
+	return edgesHit(ray, edgeStart[cell], edgeStart[cell + 1]);
+}
+
+bool OccluderGrid::blocked(const Ray& ray) const
+{
+	if (edgeStart.empty())
+		return false;
+
+	// clip the ray to the grid, t counts in deltas from the start of the ray
+	float t0 = 0, t1 = ray.maxFraction;
+	const float origin[2] = {originX, originY};
+	const float extent[2] = {width * CELL, height * CELL};
+	const float from[2] = {ray.from.x, ray.from.y};
+	const float delta[2] = {ray.delta.x, ray.delta.y};
+	for (int axis = 0; axis < 2; axis++) {
+		if (delta[axis] == 0) {
+			if (from[axis] < origin[axis] || from[axis] > origin[axis] + extent[axis])
+				return false;
+			continue;
+		}
+		float ta = (origin[axis] - from[axis]) / delta[axis];
+		float tb = (origin[axis] + extent[axis] - from[axis]) / delta[axis];
+		t0 = std::max(t0, std::min(ta, tb));
+		t1 = std::min(t1, std::max(ta, tb));
+	}
+	if (t0 > t1)
+		return false;
+
+	// walk the cells the ray crosses in order, as in Amanatides and Woo
+	const float inf = std::numeric_limits<float>::infinity();
+	int cx = cellX(ray.from.x + ray.delta.x * t0);
+	int cy = cellY(ray.from.y + ray.delta.y * t0);
+	int stepX = ray.delta.x > 0 ? 1 : -1;
+	int stepY = ray.delta.y > 0 ? 1 : -1;
+	float nextX = ray.delta.x == 0 ? inf : (originX + (cx + (stepX > 0)) * CELL - ray.from.x) / ray.delta.x;
+	float nextY = ray.delta.y == 0 ? inf : (originY + (cy + (stepY > 0)) * CELL - ray.from.y) / ray.delta.y;
+	float deltaX = ray.delta.x == 0 ? inf : CELL / std::abs(ray.delta.x);
+	float deltaY = ray.delta.y == 0 ? inf : CELL / std::abs(ray.delta.y);
+	while (true) {
+		if (blockedInCell(ray, cy * width + cx))
+			return true;
+		if (nextX < nextY) {
+			if (nextX > t1)
+				return false;
+			cx += stepX;
+			nextX += deltaX;
+		} else {
+			if (nextY > t1)
+				return false;
+			cy += stepY;
+			nextY += deltaY;
+		}
+		if (cx < 0 || cx >= width || cy < 0 || cy >= height)
+			return false;
+	}
+}
+
+static void collectEdges(b2Fixture* f, std::vector<Edge>& edges, std::vector<b2Fixture*>& circles)
+{
+	auto& xf = f->GetBody()->GetTransform();
+	switch (f->GetType()) {
+	case b2Shape::e_polygon: {
+		auto poly = (b2PolygonShape*) f->GetShape();
+		int32 count = poly->GetVertexCount();
+		for (int32 i = 0; i < count; i++)
+			edges.push_back({b2Mul(xf, poly->GetVertex(i)), b2Mul(xf, poly->GetVertex((i + 1) % count))});
+		break;
+	}
+	case b2Shape::e_chain:
+	case b2Shape::e_edge: {
+		for (int32 i = 0; i < f->GetShape()->GetChildCount(); i++) {
+			b2EdgeShape edge;
+			if (f->GetType() == b2Shape::e_chain)
+				((b2ChainShape*) f->GetShape())->GetChildEdge(&edge, i);
+			else
+				edge = *(b2EdgeShape*) f->GetShape();
+			auto a = b2Mul(xf, edge.m_vertex1);
+			auto b = b2Mul(xf, edge.m_vertex2);
+			edges.push_back({a, b});
+			edges.push_back({b, a});
+		}
+		break;
+	}
+	default:
+		circles.push_back(f);
+	}
+}
+
+static void addToMesh(b2Fixture* f, fov::mesh& mesh)
+{
+	auto& xf = f->GetBody()->GetTransform();
+	if (f->GetType() == b2Shape::e_circle) {
+		auto circle = (b2CircleShape*) f->GetShape();
+		auto pos = b2Mul(xf, circle->m_p);
+		mesh.addChain(fov::circle{fov::vec2(pos.x, pos.y), circle->m_radius});
+		return;
+	}
+	fov::chain chain;
+	if (f->GetType() == b2Shape::e_polygon) {
+		auto poly = (b2PolygonShape*) f->GetShape();
+		for (int32 i = 0; i < poly->GetVertexCount(); i++) {
+			auto v = b2Mul(xf, poly->GetVertex(i));
+			chain.emplace_back(v.x, v.y);
+		}
+	} else if (f->GetType() == b2Shape::e_chain) {
+		for (int32 i = 0; i < f->GetShape()->GetChildCount(); i++) {
+			b2EdgeShape edge;
+			((b2ChainShape*) f->GetShape())->GetChildEdge(&edge, i);
+			auto v = b2Mul(xf, edge.m_vertex1);
+			chain.emplace_back(v.x, v.y);
+		}
+	}
+	if (!chain.empty())
+		mesh.addChain(chain);
+}
+
+void build()
+{
+	std::vector<Edge> edges;
+	std::vector<b2Fixture*> circles;
+	for (auto& cm : gameState.level->collisionMasks)
+		collectEdges(cm->fixture, edges, circles);
+	masks.build(edges, circles);
+	masksMesh = fov::mesh();
+	for (auto& cm : gameState.level->collisionMasks)
+		addToMesh(cm->fixture, masksMesh);
+
+	edges.clear();
+	circles.clear();
+	for (auto& pw : gameState.level->playerwalls)
+		collectEdges(pw->fixture, edges, circles);
+	walls.build(edges, circles);
+
+	hidingSpots.clear();
+	for (auto& hs : gameState.level->hidingspots)
+		hidingSpots.push_back(hs.get());
+}
+
+bool blocked(const b2Vec2& from, const b2Vec2& to, float maxFraction, Player* player)
+{
+	Ray ray{from, to - from, maxFraction};
+	if (masks.blocked(ray) || (!player && walls.blocked(ray)))
+		return true;
+
+	b2RayCastInput input;
+	input.p1 = from;
+	input.p2 = to;
+	input.maxFraction = maxFraction;
+	b2AABB rayBox;
+	rayBox.lowerBound = b2Min(from, from + maxFraction * ray.delta);
+	rayBox.upperBound = b2Max(from, from + maxFraction * ray.delta);
+	b2RayCastOutput output;
+	for (auto hs : hidingSpots) {
+		if (!b2TestOverlap(rayBox, hs->fixture->GetAABB(0)))
+			continue;
+		if ((!player || hs->obstructsSight(player)) && hs->fixture->RayCast(&output, input, 0))
+			return true;
+	}
+	return false;
+}
+
+void calculateView(fov::view& view, const b2Vec2& origin)
+{
+	view.origin = fov::vec2(origin.x, origin.y);
+	// the server hides what is outside the polygon, the outline must stay on the real edges
+	view.outline = masksMesh.calculateOutline(view.origin, true);
+}
+
+// the bench world holds nothing but the level, any fixture box2d reports blocks the ray
+struct AnyHitCallback
+	: public b2RayCastCallback
+{
+	float32 ReportFixture(UNUSED b2Fixture *fixture, UNUSED const b2Vec2 &point, UNUSED const b2Vec2 &normal, float32 fraction)
+	{
+		hit = true;
+		return fraction;
+	}
+	bool hit = false;
+};
+
+int runBench(uint32_t rays)
+{
+	if (!gameState.b2world) {
+		gameState.b2world = std::make_unique<b2World>(b2Vec2(0, 0));
+		gameState.level = std::make_unique<Level>();
+		auto path = gameState.options["level"].as<std::string>();
+		loadLevel(path);
+	}
+
+	std::vector<b2Vec2> from, to;
+	for (uint32_t i = 0; i < rays; i++) {
+		b2Vec2 start(masks.originX + gameState.randFloat() * masks.width * CELL,
+			masks.originY + gameState.randFloat() * masks.height * CELL);
+		float angle = gameState.randFloat() * 2 * M_PI;
+		float length = BENCH_MIN_RAY + gameState.randFloat() * (BENCH_MAX_RAY - BENCH_MIN_RAY);
+		from.push_back(start);
+		to.push_back(start + length * b2Vec2(std::cos(angle), std::sin(angle)));
+	}
+
+	std::vector<uint8_t> reference(rays), grid(rays);
+	auto box2dStart = std::chrono::steady_clock::now();
+	for (uint32_t it = 0; it < BENCH_ITERATIONS; it++) {
+		for (uint32_t i = 0; i < rays; i++) {
+			AnyHitCallback callback;
+			gameState.b2world->RayCast(&callback, from[i], to[i]);
+			reference[i] = callback.hit;
+		}
+	}
+	double box2d = std::chrono::duration<double>(std::chrono::steady_clock::now() - box2dStart).count();
+
+	auto gridStart = std::chrono::steady_clock::now();
+	for (uint32_t it = 0; it < BENCH_ITERATIONS; it++) {
+		for (uint32_t i = 0; i < rays; i++)
+			grid[i] = blocked(from[i], to[i], 1, nullptr);
+	}
+	double gridTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - gridStart).count();
+
+	uint32_t disagreeing = 0;
+	for (uint32_t i = 0; i < rays; i++) {
+		if (reference[i] != grid[i])
+			disagreeing++;
+	}
+
+	double casts = (double) BENCH_ITERATIONS * rays;
+	std::cout << "sight bench: " << rays << " rays, " << BENCH_ITERATIONS << " iterations, " << kernel << " kernel\n";
+	std::cout << "box2d " << casts / box2d << " rays per second, grid " << casts / gridTime
+		<< " rays per second (" << box2d / gridTime << "x)\n";
+	// a ray grazing a vertex may come out either way depending on rounding
+	if (disagreeing > rays / 1000) {
+		std::cout << disagreeing << " rays were judged differently than by box2d\n";
+		return 1;
+	}
+
+	// every view origin looks at the ends of all the rays, once with a ray each and once culling
+	// with the visibility polygon first
+	uint32_t views = std::min(rays, BENCH_VIEWS);
+	auto raysOnlyStart = std::chrono::steady_clock::now();
+	for (uint32_t v = 0; v < views; v++) {
+		for (uint32_t i = 0; i < rays; i++)
+			grid[i] = blocked(from[v], to[i], 1, nullptr);
+	}
+	double raysOnly = std::chrono::duration<double>(std::chrono::steady_clock::now() - raysOnlyStart).count();
+
+	fov::view view;
+	auto withViewsStart = std::chrono::steady_clock::now();
+	for (uint32_t v = 0; v < views; v++) {
+		calculateView(view, from[v]);
+		for (uint32_t i = 0; i < rays; i++) {
+			if (view.contains(fov::vec2(to[i].x, to[i].y)))
+				grid[i] = blocked(from[v], to[i], 1, nullptr);
+		}
+	}
+	double withViews = std::chrono::duration<double>(std::chrono::steady_clock::now() - withViewsStart).count();
+
+	// outside the polygon must be hidden, the outline is made of real edges
+	uint32_t culled = 0;
+	uint32_t wronglyCulled = 0;
+	for (uint32_t v = 0; v < views; v++) {
+		calculateView(view, from[v]);
+		for (uint32_t i = 0; i < rays; i++) {
+			if (view.contains(fov::vec2(to[i].x, to[i].y)))
+				continue;
+			culled++;
+			if (!blocked(from[v], to[i], 1, nullptr))
+				wronglyCulled++;
+		}
+	}
+
+	double points = (double) views * rays;
+	std::cout << "views: " << views << " origins, " << rays << " points each, " << culled * 100. / points << "% culled\n";
+	std::cout << "rays " << raysOnly / points * 1e9 << "ns per point, visibility polygon and rays "
+		<< withViews / points * 1e9 << "ns per point (" << raysOnly / withViews << "x)\n";
+	if (wronglyCulled > 0) {
+		std::cout << wronglyCulled << " points were culled although a ray reaches them\n";
+		return 1;
+	}
+	return 0;
+}
+
+}
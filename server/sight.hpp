@@ -0,0 +1,35 @@
+#pragma once
+
+#include <Box2D/Box2D.h>
+
+#include "deadfish.hpp"
+#include "../common/fov.hpp"
+
+// Line of sight against the level geometry without going through the box2d world. At level load
+// the edges of the collision masks and of the player walls are put into uniform grids as
+// structure-of-arrays buffers, a ray walks the cells it crosses and tests their edges a register
+// at a time with AVX or SSE2 when the build allows it. Polygon edges only stop rays entering the
+// polygon, chain edges stop rays either way, which is what box2d does. The few hiding spots depend
+// on who is looking and are tested on their own, mobs and ink are left to the callers.
+namespace sight {
+
+// "avx", "sse2" or "scalar", chosen at compile time
+extern const char* const kernel;
+
+// collects the occluders of the loaded level, call after loadLevel
+void build();
+
+// whether the level geometry blocks the segment from from to to before maxFraction of it. With a
+// player it is what the player can't see through: the collision masks and the hiding spots the
+// player is not in. Without one the player walls and all hiding spots block as well.
+bool blocked(const b2Vec2& from, const b2Vec2& to, float maxFraction, Player* player);
+
+// the visibility polygon of the collision masks around origin, the same outline the clients draw
+// their shadows from. A point outside it is hidden, a point inside still needs blocked to be sure
+void calculateView(fov::view& view, const b2Vec2& origin);
+
+// times blocked against box2d raycasts on this many random rays, then against culling with
+// visibility polygons first, returns the process exit code
+int runBench(uint32_t rays);
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Points bucketed by the grid cell they are in, for finding what is near a point without going
+// through everything. It is rebuilt from scratch whenever the points move, with a counting sort
+// into a fixed number of buckets, so once the vectors have grown a rebuild doesn't allocate.
+class SpatialHash {
+public:
+	explicit SpatialHash(float cellSize) : cellSize(cellSize) {}
+
+	void build(const float* x, const float* y, size_t n) {
+		bucketStart.assign(BUCKETS + 1, 0);
+		bucketOf.resize(n);
+		sorted.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			bucketOf[i] = bucket(cell(x[i]), cell(y[i]));
+			bucketStart[bucketOf[i] + 1]++;
+		}
+		for (size_t b = 0; b < BUCKETS; b++)
+			bucketStart[b + 1] += bucketStart[b];
+		fill.assign(bucketStart.begin(), bucketStart.end() - 1);
+		for (size_t i = 0; i < n; i++)
+			sorted[fill[bucketOf[i]]++] = i;
+	}
+
+	// calls f with the index of every point in the cell of (x, y) and the cells around it, that is
+	// every point closer than cellSize and some further away, different cells can share a bucket
+	template<typename F>
+	void forNear(float x, float y, F f) const {
+		int cx = cell(x), cy = cell(y);
+		for (int by = cy - 1; by <= cy + 1; by++) {
+			for (int bx = cx - 1; bx <= cx + 1; bx++) {
+				size_t b = bucket(bx, by);
+				for (uint32_t k = bucketStart[b]; k < bucketStart[b + 1]; k++)
+					f(sorted[k]);
+			}
+		}
+	}
+
+private:
+	static const size_t BUCKETS = 4096;
+
+	int cell(float v) const {
+		return (int) std::floor(v / cellSize);
+	}
+	static size_t bucket(int cx, int cy) {
+		return ((uint32_t) cx * 73856093u ^ (uint32_t) cy * 19349663u) % BUCKETS;
+	}
+
+	float cellSize;
+	std::vector<uint32_t> bucketStart;
+	std::vector<uint32_t> bucketOf;
+	std::vector<uint32_t> sorted;
+	std::vector<uint32_t> fill;
+};
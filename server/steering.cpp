@@ -0,0 +1,265 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "steering.hpp"
+#include "avoidance.hpp"
+#include "game_thread.hpp"
+
+namespace steering {
+
+#if defined(__AVX__)
+const char* const kernel = "avx";
+#elif defined(__SSE2__)
+const char* const kernel = "sse2";
+#else
+const char* const kernel = "scalar";
+#endif
+
+// |angle to the target| < ANGULAR_CLOSE is the same as cos(angle) > COS_ANGULAR_CLOSE
+static const float COS_ANGULAR_CLOSE = std::cos(ANGULAR_CLOSE);
+static const float COS_ANGULAR_SLOW = std::cos(ANGULAR_CLOSE * 2);
+
+static Batch queued;
+
+void Batch::clear()
+{
+	mobs.clear();
+	posX.clear();
+	posY.clear();
+	sin.clear();
+	cos.clear();
+	targetX.clear();
+	targetY.clear();
+	speed.clear();
+	avoids.clear();
+}
+
+void Batch::add(Mob& m, bool avoids)
+{
+	auto& transform = m.body->GetTransform();
+	mobs.push_back(&m);
+	posX.push_back(transform.p.x);
+	posY.push_back(transform.p.y);
+	sin.push_back(transform.q.s);
+	cos.push_back(transform.q.c);
+	targetX.push_back(m.targetPosition.x);
+	targetY.push_back(m.targetPosition.y);
+	speed.push_back(m.calculateSpeed());
+	this->avoids.push_back(avoids);
+}
+
+void computeScalar(Batch& batch, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++) {
+		float dx = batch.targetX[i] - batch.posX[i];
+		float dy = batch.targetY[i] - batch.posY[i];
+		float dist2 = dx * dx + dy * dy;
+		if (dist2 < CLOSE * CLOSE) {
+			// don't move if really close to target
+			batch.angularVelocity[i] = 0;
+			batch.velocityX[i] = 0;
+			batch.velocityY[i] = 0;
+			continue;
+		}
+		float invDist = 1 / std::sqrt(dist2);
+		// the mob faces its angle - 90 degrees
+		float headingX = batch.sin[i];
+		float headingY = -batch.cos[i];
+		float dot = (headingX * dx + headingY * dy) * invDist;
+		float cross = (headingX * dy - headingY * dx) * invDist;
+
+		float turnSpeed = dot > COS_ANGULAR_SLOW ? TURN_SPEED / 2 : TURN_SPEED;
+		if (dot > COS_ANGULAR_CLOSE)
+			batch.angularVelocity[i] = 0;
+		else
+			batch.angularVelocity[i] = cross > 0 ? turnSpeed : -turnSpeed;
+		batch.velocityX[i] = headingX * batch.speed[i];
+		batch.velocityY[i] = headingY * batch.speed[i];
+	}
+}
+
+#if defined(__AVX__)
+static size_t computeSimd(Batch& batch)
+{
+	const size_t n = batch.size() / 8 * 8;
+	const __m256 close2 = _mm256_set1_ps(CLOSE * CLOSE);
+	const __m256 cosClose = _mm256_set1_ps(COS_ANGULAR_CLOSE);
+	const __m256 cosSlow = _mm256_set1_ps(COS_ANGULAR_SLOW);
+	const __m256 turn = _mm256_set1_ps(TURN_SPEED);
+	const __m256 slowTurn = _mm256_set1_ps(TURN_SPEED / 2);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1);
+	const __m256 signBit = _mm256_set1_ps(-0.f);
+	for (size_t i = 0; i < n; i += 8) {
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&batch.targetX[i]), _mm256_loadu_ps(&batch.posX[i]));
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&batch.targetY[i]), _mm256_loadu_ps(&batch.posY[i]));
+		__m256 dist2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+		__m256 moving = _mm256_cmp_ps(dist2, close2, _CMP_GE_OQ);
+		__m256 invDist = _mm256_div_ps(one, _mm256_sqrt_ps(dist2));
+
+		__m256 headingX = _mm256_loadu_ps(&batch.sin[i]);
+		__m256 headingY = _mm256_xor_ps(_mm256_loadu_ps(&batch.cos[i]), signBit);
+		__m256 dot = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(headingX, dx), _mm256_mul_ps(headingY, dy)), invDist);
+		__m256 cross = _mm256_sub_ps(_mm256_mul_ps(headingX, dy), _mm256_mul_ps(headingY, dx));
+
+		__m256 turnSpeed = _mm256_blendv_ps(turn, slowTurn, _mm256_cmp_ps(dot, cosSlow, _CMP_GT_OQ));
+		// negate where the target is clockwise
+		turnSpeed = _mm256_or_ps(turnSpeed, _mm256_and_ps(_mm256_cmp_ps(cross, zero, _CMP_LE_OQ), signBit));
+		__m256 turning = _mm256_andnot_ps(_mm256_cmp_ps(dot, cosClose, _CMP_GT_OQ), moving);
+		_mm256_storeu_ps(&batch.angularVelocity[i], _mm256_and_ps(turnSpeed, turning));
+
+		__m256 speed = _mm256_and_ps(_mm256_loadu_ps(&batch.speed[i]), moving);
+		_mm256_storeu_ps(&batch.velocityX[i], _mm256_mul_ps(headingX, speed));
+		_mm256_storeu_ps(&batch.velocityY[i], _mm256_mul_ps(headingY, speed));
+	}
+	return n;
+}
+#elif defined(__SSE2__)
+static size_t computeSimd(Batch& batch)
+{
+	const size_t n = batch.size() / 4 * 4;
+	const __m128 close2 = _mm_set1_ps(CLOSE * CLOSE);
+	const __m128 cosClose = _mm_set1_ps(COS_ANGULAR_CLOSE);
+	const __m128 cosSlow = _mm_set1_ps(COS_ANGULAR_SLOW);
+	const __m128 turn = _mm_set1_ps(TURN_SPEED);
+	const __m128 slowTurn = _mm_set1_ps(TURN_SPEED / 2);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1);
+	const __m128 signBit = _mm_set1_ps(-0.f);
+	for (size_t i = 0; i < n; i += 4) {
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(&batch.targetX[i]), _mm_loadu_ps(&batch.posX[i]));
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(&batch.targetY[i]), _mm_loadu_ps(&batch.posY[i]));
+		__m128 dist2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+		__m128 moving = _mm_cmpge_ps(dist2, close2);
+		__m128 invDist = _mm_div_ps(one, _mm_sqrt_ps(dist2));
+
+		__m128 headingX = _mm_loadu_ps(&batch.sin[i]);
+		__m128 headingY = _mm_xor_ps(_mm_loadu_ps(&batch.cos[i]), signBit);
+		__m128 dot = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(headingX, dx), _mm_mul_ps(headingY, dy)), invDist);
+		__m128 cross = _mm_sub_ps(_mm_mul_ps(headingX, dy), _mm_mul_ps(headingY, dx));
+
+		// SSE2 has no blend, select with and/andnot
+		__m128 slow = _mm_cmpgt_ps(dot, cosSlow);
+		__m128 turnSpeed = _mm_or_ps(_mm_and_ps(slow, slowTurn), _mm_andnot_ps(slow, turn));
+		// negate where the target is clockwise
+		turnSpeed = _mm_or_ps(turnSpeed, _mm_and_ps(_mm_cmple_ps(cross, zero), signBit));
+		__m128 turning = _mm_andnot_ps(_mm_cmpgt_ps(dot, cosClose), moving);
+		_mm_storeu_ps(&batch.angularVelocity[i], _mm_and_ps(turnSpeed, turning));
+
+		__m128 speed = _mm_and_ps(_mm_loadu_ps(&batch.speed[i]), moving);
+		_mm_storeu_ps(&batch.velocityX[i], _mm_mul_ps(headingX, speed));
+		_mm_storeu_ps(&batch.velocityY[i], _mm_mul_ps(headingY, speed));
+	}
+	return n;
+}
+#else
+static size_t computeSimd(Batch&)
+{
+	return 0;
+}
+#endif
+
+void compute(Batch& batch)
+{
+	batch.angularVelocity.resize(batch.size());
+	batch.velocityX.resize(batch.size());
+	batch.velocityY.resize(batch.size());
+	// the vector loop leaves the remainder that doesn't fill a whole register
+	computeScalar(batch, computeSimd(batch), batch.size());
+}
+
+void apply(const Batch& batch)
+{
+	for (size_t i = 0; i < batch.size(); i++) {
+		auto body = batch.mobs[i]->body;
+		body->SetAngularVelocity(batch.angularVelocity[i]);
+		body->SetLinearVelocity(b2Vec2(batch.velocityX[i], batch.velocityY[i]));
+	}
+}
+
+void queue(Mob& m, bool avoids)
+{
+	// the maps erase such mobs right after their update, they must not be in the batch by then,
+	// and dead players have no body to steer
+	if (m.toBeDeleted || !m.body)
+		return;
+	queued.add(m, avoids);
+}
+
+void steerQueued()
+{
+	compute(queued);
+	if (gameState.options["avoidance"].as<bool>())
+		avoidance::adjust(queued);
+	apply(queued);
+	queued.clear();
+}
+
+int runBench(uint32_t mobs)
+{
+	const uint32_t iterations = 1000;
+	if (!gameState.b2world)
+		gameState.b2world = std::make_unique<b2World>(b2Vec2(0, 0));
+
+	std::vector<std::unique_ptr<Civilian>> civilians;
+	for (uint32_t i = 0; i < mobs; i++) {
+		auto c = std::make_unique<Civilian>();
+		glm::vec2 pos(gameState.randFloat() * 100, gameState.randFloat() * 100);
+		// a few turns either way, the way a mob's body angle piles up in a match
+		physicsInitMob(c.get(), pos, (gameState.randFloat() - 0.5f) * 8 * M_PI, 0.3f, 1);
+		c->targetPosition = glm::vec2(gameState.randFloat() * 100, gameState.randFloat() * 100);
+		civilians.push_back(std::move(c));
+	}
+
+	// the velocities Mob::update gives, to compare the kernel against
+	std::vector<b2Vec2> reference;
+	std::vector<float> referenceAngular;
+	auto perObjectStart = std::chrono::steady_clock::now();
+	for (uint32_t it = 0; it < iterations; it++) {
+		for (auto& c : civilians) {
+			Mob* m = c.get();
+			m->Mob::update();
+		}
+	}
+	double perObject = std::chrono::duration<double>(std::chrono::steady_clock::now() - perObjectStart).count();
+	for (auto& c : civilians) {
+		reference.push_back(c->body->GetLinearVelocity());
+		referenceAngular.push_back(c->body->GetAngularVelocity());
+	}
+
+	Batch batch;
+	auto batchedStart = std::chrono::steady_clock::now();
+	for (uint32_t it = 0; it < iterations; it++) {
+		batch.clear();
+		for (auto& c : civilians)
+			batch.add(*c);
+		compute(batch);
+		apply(batch);
+	}
+	double batched = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchedStart).count();
+
+	uint32_t disagreeing = 0;
+	for (size_t i = 0; i < civilians.size(); i++) {
+		auto body = civilians[i]->body;
+		if ((body->GetLinearVelocity() - reference[i]).Length() > 1e-4f
+			|| std::abs(body->GetAngularVelocity() - referenceAngular[i]) > 1e-4f)
+			disagreeing++;
+	}
+
+	double calls = (double) iterations * mobs;
+	std::cout << "steering bench: " << mobs << " mobs, " << iterations << " iterations, " << kernel << " kernel\n";
+	std::cout << "Mob::update " << perObject / calls * 1e9 << "ns per mob, batched "
+		<< batched / calls * 1e9 << "ns per mob (" << perObject / batched << "x)\n";
+	if (disagreeing > 0) {
+		std::cout << disagreeing << " mobs got a different linear or angular velocity from the batched kernel\n";
+		return 1;
+	}
+	return 0;
+}
+
+}
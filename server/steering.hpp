@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include "deadfish.hpp"
+
+// Batched steering of the mobs. During the update pass mobs are queued instead of steering
+// themselves one by one, steerQueued then computes the velocities of all of them at once on
+// structure-of-arrays buffers, with AVX or SSE2 when the build allows it, and writes them back
+// to the bodies. The heading comes from the rotation Box2D already keeps as sine and cosine and
+// the angle to the target is judged by dot and cross products, so there is no trigonometry.
+namespace steering {
+
+struct Batch {
+	std::vector<Mob*> mobs;
+	std::vector<float> posX, posY, sin, cos, targetX, targetY, speed;
+	// whether avoidance may change the velocity of the mob, only civilians give way
+	std::vector<uint8_t> avoids;
+	std::vector<float> angularVelocity, velocityX, velocityY;
+
+	void clear();
+	void add(Mob& m, bool avoids = false);
+	size_t size() const { return mobs.size(); }
+};
+
+// "avx", "sse2" or "scalar", chosen at compile time
+extern const char* const kernel;
+
+void computeScalar(Batch& batch, size_t begin, size_t end);
+void compute(Batch& batch);
+void apply(const Batch& batch);
+
+// replaces Mob::update in the tick, mobs that are to be deleted are skipped
+void queue(Mob& m, bool avoids = false);
+// after all mobs were updated, before the next physics step, runs the avoidance unless --avoidance is off
+void steerQueued();
+
+// times the batched kernel against Mob::update on mobs civilians, returns the process exit code
+int runBench(uint32_t mobs);
+
+}
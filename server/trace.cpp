@@ -0,0 +1,152 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "deadfish.hpp"
+#include "trace.hpp"
+
+namespace trace {
+
+struct Event {
+	const char* name;
+	uint64_t start;
+	uint64_t duration;
+	uint32_t thread;
+};
+
+// 2^16 events hold a few hundred ticks of a busy match
+static const uint64_t RING_SIZE = 1 << 16;
+
+bool enabled = false;
+static std::unique_ptr<Event[]> ring;
+static std::atomic<uint64_t> writeIndex{0};
+static std::atomic<bool> dumpFlag{false};
+static std::atomic<uint32_t> lastThread{0};
+static std::string tracePath;
+static uint32_t ticksLeft = 0;
+static const auto epoch = std::chrono::steady_clock::now();
+
+// the game thread only copies the ring, the writer formats the json
+static std::mutex snapshotMut;
+static std::condition_variable snapshotCond;
+static std::vector<Event> snapshot;
+static bool snapshotReady = false;
+
+static void write(const std::vector<Event>& events)
+{
+	std::ofstream out(tracePath, std::ios::trunc);
+	out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+	for (size_t i = 0; i < events.size(); i++) {
+		auto& e = events[i];
+		out << (i == 0 ? "" : ",\n")
+			<< "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+			<< ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << e.duration / 1000.0 << "}";
+	}
+	out << "\n]}\n";
+	if (!out) {
+		std::cout << "could not write trace to " << tracePath << "\n";
+		return;
+	}
+	std::cout << "wrote " << events.size() << " trace events to " << tracePath << "\n";
+}
+
+static void writeSnapshots()
+{
+	std::vector<Event> events;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(snapshotMut);
+			snapshotCond.wait(lock, []{ return snapshotReady; });
+			// the buffers trade places so neither side allocates after the first dump
+			events.swap(snapshot);
+			snapshotReady = false;
+		}
+		write(events);
+	}
+}
+
+void start(const std::string& path, uint32_t ticks)
+{
+	ring.reset(new Event[RING_SIZE]);
+	snapshot.reserve(RING_SIZE);
+	tracePath = path;
+	ticksLeft = ticks;
+	enabled = true;
+	new std::thread(writeSnapshots);
+}
+
+void requestDump()
+{
+	dumpFlag = true;
+}
+
+uint64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void record(const char* name, uint64_t start, uint64_t duration)
+{
+	static thread_local uint32_t thread = ++lastThread;
+	// writers only claim a slot, the oldest events get overwritten once the ring is full
+	auto& e = ring[writeIndex.fetch_add(1, std::memory_order_relaxed) % RING_SIZE];
+	e.name = name;
+	e.start = start;
+	e.duration = duration;
+	e.thread = thread;
+}
+
+void recordStepProfile(uint64_t stepStart)
+{
+	// b2Profile only has durations in milliseconds, lay them out in the order b2World::Step runs them
+	const b2Profile& profile = gameState.b2world->GetProfile();
+	auto ns = [](float32 ms){ return (uint64_t) (ms * 1000000); };
+	uint64_t t = stepStart;
+	record("b2 collide", t, ns(profile.collide));
+	t += ns(profile.collide);
+	record("b2 solve", t, ns(profile.solve));
+	uint64_t solveT = t;
+	record("b2 solve init", solveT, ns(profile.solveInit));
+	solveT += ns(profile.solveInit);
+	record("b2 solve velocity", solveT, ns(profile.solveVelocity));
+	solveT += ns(profile.solveVelocity);
+	record("b2 solve position", solveT, ns(profile.solvePosition));
+	solveT += ns(profile.solvePosition);
+	record("b2 broadphase", solveT, ns(profile.broadphase));
+	t += ns(profile.solve);
+	record("b2 solve TOI", t, ns(profile.solveTOI));
+}
+
+// a dump requested while the previous one is still being written replaces the events it had not
+// picked up yet
+static void dump()
+{
+	uint64_t end = writeIndex.load();
+	uint64_t begin = end > RING_SIZE ? end - RING_SIZE : 0;
+	{
+		std::lock_guard<std::mutex> lock(snapshotMut);
+		snapshot.clear();
+		for (uint64_t i = begin; i < end; i++)
+			snapshot.push_back(ring[i % RING_SIZE]);
+		snapshotReady = true;
+	}
+	snapshotCond.notify_one();
+}
+
+void endTick()
+{
+	bool dumpNow = dumpFlag.exchange(false);
+	if (ticksLeft > 0 && --ticksLeft == 0)
+		dumpNow = true;
+	if (dumpNow)
+		dump();
+}
+
+}; // trace
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "alloc_tracking.hpp"
+
+// Scoped markers recorded into a lock-free ring buffer and dumped as Chrome trace JSON
+// (load the file in chrome://tracing or ui.perfetto.dev). Markers cost a single branch while tracing is off.
+namespace trace {
+
+extern bool enabled;
+
+// starts recording, the trace is written to path after ticks game loop ticks (never if 0) or on requestDump
+void start(const std::string& path, uint32_t ticks);
+// safe to call from a signal handler, the dump happens at the end of the current tick
+void requestDump();
+// called by the game thread at the end of every tick while tracing is enabled
+void endTick();
+
+uint64_t now();
+// records a finished event, start and duration are in nanoseconds as returned by now()
+void record(const char* name, uint64_t start, uint64_t duration);
+// records the b2Profile breakdown of the world step that began at stepStart
+void recordStepProfile(uint64_t stepStart);
+
+struct Scope {
+	Scope(const char* name) : name(name), begin(enabled ? now() : 0) {}
+	~Scope() {
+		if (enabled)
+			record(name, begin, now() - begin);
+	}
+
+	const char* name;
+	uint64_t begin;
+};
+
+}; // trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// name has to be a string literal, only the pointer is stored. Opens an allocation phase of the same name too.
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name); ALLOC_PHASE(name)
@@ -1,4 +1,5 @@
 #include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
 #include <boost/beast/websocket.hpp>
 #include <boost/asio/dispatch.hpp>
 #include <boost/asio/strand.hpp>
@@ -20,7 +21,9 @@ namespace websocket = beast::websocket; // from <boost/beast/websocket.hpp>
 namespace net = boost::asio;            // from <boost/asio.hpp>
 
 #include "websocket.hpp"
+#include "bandwidth.hpp"
 #include "deadfish.hpp"
+#include "metrics.hpp"
 
 class DfWebsocket;
 
@@ -28,10 +31,13 @@ net::io_context ioc{1};
 tcp::acceptor acceptor{ioc};
 uint16_t lastSocketID = 0;
 std::vector<std::shared_ptr<DfWebsocket>> sockets;
+tcp::acceptor httpAcceptor{ioc};
 
 static dfws::OnMessageHandler onMessageHandler = nullptr;
 static dfws::OnOpenHandler onOpenHandler = nullptr;
 static dfws::OnCloseHandler onCloseHandler = nullptr;
+static std::string httpTarget;
+static dfws::HttpHandler httpHandler = nullptr;
 
 void
 fail(beast::error_code ec, char const* what)
@@ -58,6 +64,21 @@ class DfWebsocket : public std::enable_shared_from_this<DfWebsocket> {
     websocket::stream<beast::tcp_stream> ws_;
     beast::flat_buffer buffer_;
 
+    // resolved once, counting a message must not look the connection up by name
+    metrics::LabeledCounter::Child sentBytes_;
+    metrics::LabeledCounter::Child sentMessages_;
+    metrics::LabeledCounter::Child receivedBytes_;
+    metrics::LabeledCounter::Child receivedMessages_;
+
+    void OnClosed() {
+        auto label = std::to_string(socketID_);
+        metrics::connectionSentBytes.remove(label);
+        metrics::connectionSentMessages.remove(label);
+        metrics::connectionReceivedBytes.remove(label);
+        metrics::connectionReceivedMessages.remove(label);
+        forgetConnection(socketID_);
+    }
+
 public:
     uint16_t socketID_;
 
@@ -67,6 +88,11 @@ public:
         : ws_(std::move(socket)), socketID_(socketID)
     {
         ws_.binary(true);
+        auto label = std::to_string(socketID_);
+        sentBytes_ = metrics::connectionSentBytes.child(label);
+        sentMessages_ = metrics::connectionSentMessages.child(label);
+        receivedBytes_ = metrics::connectionReceivedBytes.child(label);
+        receivedMessages_ = metrics::connectionReceivedMessages.child(label);
     }
 
     void start() {
@@ -104,6 +130,7 @@ public:
         if (ec)
             return fail(ec, "accept");
 
+        trackConnection(socketID_);
         onOpenHandler(socketID_);
 
         DoRead();
@@ -118,33 +145,111 @@ public:
 
         // This indicates that the session was closed
         if (ec == websocket::error::closed)
-            return;
+            return OnClosed();
 
         if (ec) {
             if (ec.value() == boost::system::errc::operation_canceled) {
                 // this websocket has disconnected
                 // TODO delete it from the vector
                 onCloseHandler(socketID_);
-                return;
+                return OnClosed();
             }
             fail(ec, "read");
         }
 
         auto str = beast::buffers_to_string(buffer_.data());
+        receivedBytes_->fetch_add(str.size(), std::memory_order_relaxed);
+        receivedMessages_->fetch_add(1, std::memory_order_relaxed);
         onMessageHandler(socketID_, str);
         buffer_.consume(buffer_.size());
 
         DoRead();
     }
 
+    void Close() {
+        // the pending read then finishes with websocket::error::closed
+        ws_.async_close(websocket::close_code::normal,
+            [self = shared_from_this()](beast::error_code ec) {
+                if (ec)
+                    fail(ec, "close");
+            });
+    }
+
     void Send(const std::string& data) {
         // sync write
         ws_.write(net::buffer(data));
+        sentBytes_->fetch_add(data.size(), std::memory_order_relaxed);
+        sentMessages_->fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// answers a single plain http request and closes the connection
+class DfHttpSession : public std::enable_shared_from_this<DfHttpSession> {
+    beast::tcp_stream stream_;
+    beast::flat_buffer buffer_;
+    http::request<http::string_body> req_;
+    http::response<http::string_body> res_;
+
+public:
+    explicit
+    DfHttpSession(tcp::socket&& socket)
+        : stream_(std::move(socket))
+    {
+    }
+
+    void start() {
+        stream_.expires_after(std::chrono::seconds(30));
+        http::async_read(stream_, buffer_, req_,
+            beast::bind_front_handler(
+                &DfHttpSession::OnRead,
+                shared_from_this()));
+    }
+
+    void OnRead(beast::error_code ec, std::size_t bytes_transferred)
+    {
+        boost::ignore_unused(bytes_transferred);
+
+        if (ec == http::error::end_of_stream)
+            return;
+        if (ec)
+            return fail(ec, "http read");
+
+        res_.version(req_.version());
+        res_.keep_alive(false);
+        res_.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        if (req_.method() == http::verb::get && req_.target() == httpTarget) {
+            res_.result(http::status::ok);
+            res_.set(http::field::content_type, "text/plain; version=0.0.4");
+            res_.body() = httpHandler();
+        } else {
+            res_.result(http::status::not_found);
+            res_.set(http::field::content_type, "text/plain");
+            res_.body() = "not found\n";
+        }
+        res_.prepare_payload();
+
+        http::async_write(stream_, res_,
+            beast::bind_front_handler(
+                &DfHttpSession::OnWrite,
+                shared_from_this()));
+    }
+
+    void OnWrite(beast::error_code ec, std::size_t bytes_transferred)
+    {
+        boost::ignore_unused(bytes_transferred);
+
+        if (ec)
+            return fail(ec, "http write");
+
+        stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
     }
 };
 
 void dfws::SendData(Handle hdl, const std::string& data)
 {
+    if (hdl == INVALID_HANDLE)
+        return;
+    accountServerMessage(hdl, data);
     for (auto& s : sockets) {
         if (s->socketID_ == hdl) {
             s->Send(data);
@@ -155,6 +260,18 @@ void dfws::SendData(Handle hdl, const std::string& data)
     exit(1);
 }
 
+void dfws::CloseAll()
+{
+    for (auto& s : sockets)
+        s->Close();
+    sockets.clear();
+}
+
+void dfws::Post(std::function<void()> f)
+{
+    net::post(ioc, std::move(f));
+}
+
 void dfwsOnAccept(beast::error_code ec, tcp::socket socket)
 {
     std::cout << "on accept\n";
@@ -169,7 +286,16 @@ void dfwsOnAccept(beast::error_code ec, tcp::socket socket)
     acceptor.async_accept(&dfwsOnAccept);
 }
 
-void dfws::Run(unsigned short port)
+void dfHttpOnAccept(beast::error_code ec, tcp::socket socket)
+{
+    if (ec)
+        return fail(ec, "http accept");
+    std::make_shared<DfHttpSession>(std::move(socket))->start();
+
+    httpAcceptor.async_accept(&dfHttpOnAccept);
+}
+
+static bool openAcceptor(tcp::acceptor& acceptor, unsigned short port)
 {
     auto const address = net::ip::make_address("0.0.0.0");
     beast::error_code ec;
@@ -180,7 +306,7 @@ void dfws::Run(unsigned short port)
     if (ec)
     {
         fail(ec, "open");
-        return;
+        return false;
     }
 
     // Allow address reuse
@@ -188,7 +314,7 @@ void dfws::Run(unsigned short port)
     if (ec)
     {
         fail(ec, "set_option");
-        return;
+        return false;
     }
 
     // Bind to the server address
@@ -196,7 +322,7 @@ void dfws::Run(unsigned short port)
     if (ec)
     {
         fail(ec, "bind");
-        return;
+        return false;
     }
 
     // Start listening for connections
@@ -205,8 +331,25 @@ void dfws::Run(unsigned short port)
     if (ec)
     {
         fail(ec, "listen");
-        return;
+        return false;
     }
+    return true;
+}
+
+bool dfws::ServeHttp(unsigned short port, const std::string& target, HttpHandler handler)
+{
+    if (!openAcceptor(httpAcceptor, port))
+        return false;
+    httpTarget = target;
+    httpHandler = handler;
+    httpAcceptor.async_accept(&dfHttpOnAccept);
+    return true;
+}
+
+void dfws::Run(unsigned short port)
+{
+    if (!openAcceptor(acceptor, port))
+        return;
 
     acceptor.async_accept(&dfwsOnAccept);
     ioc.run();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <string>
 
 #include <boost/asio/ip/tcp.hpp>
@@ -9,15 +10,25 @@ using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
 namespace dfws {
 
 typedef int Handle;
+// the handle of players that are not connected, sending to it does nothing
+const Handle INVALID_HANDLE = -1;
 
 typedef void (*OnMessageHandler) (Handle hdl, const std::string& msg);
 typedef void (*OnOpenHandler) (Handle hdl);
 typedef void (*OnCloseHandler) (Handle hdl);
+typedef std::string (*HttpHandler) ();
 
 void SendData(Handle hdl, const std::string& data);
 void SetOnMessage(OnMessageHandler msgHandler);
 void SetOnOpen(OnOpenHandler handler);
 void SetOnClose(OnCloseHandler handler);
 void Run(unsigned short port);
+// answers http GET requests for target on a second port, served by the websocket thread as well
+// has to be called before Run
+bool ServeHttp(unsigned short port, const std::string& target, HttpHandler handler);
+// runs f on the websocket thread
+void Post(std::function<void()> f);
+// closes every websocket connection, has to run on the websocket thread
+void CloseAll();
 
 };
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "workers.hpp"
+
+namespace workers {
+
+// below this many items waking the workers costs more than it saves
+const size_t MIN_PARALLEL = 64;
+// chunks per thread, a few more than one keeps the threads busy when chunks take uneven time
+const size_t CHUNKS_PER_THREAD = 4;
+
+static unsigned workerCount = 0;
+// leaked together with the threads, destroying a condition variable somebody still waits on blocks the exit
+struct Pool {
+	std::mutex mut;
+	std::condition_variable wake;
+	std::condition_variable done;
+};
+static Pool* pool = nullptr;
+static uint64_t generation = 0;
+static unsigned busy = 0;
+
+static const std::function<void(size_t, size_t)>* job = nullptr;
+static size_t jobSize = 0;
+static size_t chunkSize = 1;
+static std::atomic<size_t> nextChunk{0};
+
+static void runChunks()
+{
+	while (true) {
+		size_t begin = nextChunk.fetch_add(chunkSize, std::memory_order_relaxed);
+		if (begin >= jobSize)
+			return;
+		(*job)(begin, std::min(begin + chunkSize, jobSize));
+	}
+}
+
+static void workerLoop()
+{
+	uint64_t seen = 0;
+	std::unique_lock<std::mutex> lock(pool->mut);
+	while (true) {
+		pool->wake.wait(lock, [&]{ return generation != seen; });
+		seen = generation;
+		lock.unlock();
+		runChunks();
+		lock.lock();
+		if (--busy == 0)
+			pool->done.notify_one();
+	}
+}
+
+void start(unsigned count)
+{
+	workerCount = count;
+	pool = new Pool;
+	for (unsigned i = 0; i < count; i++)
+		new std::thread(workerLoop); // they live as long as the process
+}
+
+void parallelFor(size_t n, const std::function<void(size_t begin, size_t end)>& fn)
+{
+	if (workerCount == 0 || n < MIN_PARALLEL) {
+		fn(0, n);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(pool->mut);
+		job = &fn;
+		jobSize = n;
+		chunkSize = std::max<size_t>(1, n / ((workerCount + 1) * CHUNKS_PER_THREAD));
+		nextChunk.store(0, std::memory_order_relaxed);
+		busy = workerCount;
+		generation++;
+	}
+	pool->wake.notify_all();
+	runChunks();
+	std::unique_lock<std::mutex> lock(pool->mut);
+	pool->done.wait(lock, []{ return busy == 0; });
+}
+
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// A fixed pool of worker threads for the data parallel parts of the tick. The game thread hands
+// out one job at a time and works on it too, so a pool of n workers runs the job on n + 1 threads.
+namespace workers {
+
+// without a call to start, or with count 0, parallelFor runs everything on the calling thread
+void start(unsigned count);
+
+// calls fn on consecutive chunks of [0, n) spread over the workers and returns when all are done
+void parallelFor(size_t n, const std::function<void(size_t begin, size_t end)>& fn);
+
+}
@@ -1,8 +1,10 @@
 #!/usr/bin/python3
 import pyautogui
 import subprocess
+import tempfile
 import time
 import os
+import re
 import logging
 from pytest import mark
 
@@ -16,6 +18,17 @@ def infinite_retry_click(file):
 
 logger = logging.getLogger()
 
+def server_env():
+    deadfish_path = os.path.abspath("..")
+    server_build_path = deadfish_path + "/server/build"
+    my_env = os.environ.copy()
+    my_env["LD_LIBRARY_PATH"] = server_build_path
+    return my_env
+
+def run_server(*args):
+    # this will raise an error on a non-zero return code
+    return subprocess.check_output(["./deadfishserver", "-l", "../../levels/test.bin", *args], cwd="../server/build", env=server_env()).decode()
+
 def test_levelpacker():
     # this will raise an error on a non-zero return code
     subprocess.check_output(["./levelpacker.py"], cwd="../levelpacker")
@@ -46,7 +59,9 @@ def test_two_clients_kill():
     server_build_path = deadfish_path + "/server/build"
     my_env = os.environ.copy()
     my_env["LD_LIBRARY_PATH"] = server_build_path
-    server = subprocess.Popen(["./deadfishserver", "-p", "63987", "-l", "../../levels/test.bin", "-n", "2", "-t"], cwd="../server/build", env=my_env)
+    journal_dir = tempfile.mkdtemp()
+    server = subprocess.Popen(["./deadfishserver", "-p", "63987", "-l", "../../levels/test.bin", "-n", "2", "-t",
+        "--seed", "1234", "--journaldir", journal_dir], cwd="../server/build", env=my_env)
     client0 = subprocess.Popen("./deadfishclient", cwd="../client/dfclient-native")
     infinite_retry_click("connect.png")
     pyautogui.moveTo(100, 100)
@@ -64,3 +79,69 @@ def test_two_clients_kill():
     server.kill()
     client0.kill()
     client1.kill()
+    # the journal of the match has to replay to the same checksums, this raises on a divergence,
+    # the match ran on the game thread alone so this also checks the workers don't change the simulation
+    output = run_server("--replay", journal_dir + "/1234.dfj", "--workers", "2")
+    assert("checksums matched" in output)
+
+def test_metrics_endpoint():
+    server = subprocess.Popen(["./deadfishserver", "-p", "63987", "-l", "../../levels/test.bin", "--metricsport", "63988"], cwd="../server/build", env=server_env())
+    time.sleep(1)
+    # this will raise an error on a non-zero return code
+    output = subprocess.check_output(["./scrape_metrics.py", "http://localhost:63988/metrics"]).decode()
+    assert("deadfish_players 0" in output)
+    assert(server.poll() == None)
+    server.kill()
+
+def test_bench():
+    # the allocation budget is not checked here, that takes a DEADFISH_ALLOC_TRACKING build run with --allocbudget
+    output = run_server("--bench", "200")
+    assert("tick time median" in output)
+
+def test_recording_seek():
+    record_dir = tempfile.mkdtemp()
+    # 250 ticks end in the middle of the third chunk, the last tick is rebuilt from a keyframe and 49 deltas
+    output = run_server("--bench", "250", "--seed", "1234", "--recorddir", record_dir)
+    recorded = re.search(r"recorded up to tick (\d+) mobs checksum (\d+)", output)
+    # this raises when seeking through the index rebuilds a tick differently than playing the file
+    output = run_server("--verifyrecording", record_dir + "/1234.dfrec")
+    rebuilt = re.search(r"recording: 250 frames in 3 chunks, tick (\d+) mobs checksum (\d+)", output)
+    assert(rebuilt.groups() == recorded.groups())
+
+def test_avoidance_fewer_stuck():
+    # twice the usual crowd, civilians walking straight at their targets run into each other
+    stuck, despawns, raycasts = {}, {}, {}
+    for avoidance in ["true", "false"]:
+        output = run_server("--bench", "2400", "--seed", "1234", "--maxcivilians", "200", "--avoidance=" + avoidance)
+        counters = re.search(r"civilians stuck (\d+), forced despawns (\d+), resolution raycasts (\d+)", output)
+        stuck[avoidance] = int(counters.group(1))
+        despawns[avoidance] = int(counters.group(2))
+        raycasts[avoidance] = int(counters.group(3))
+    # without the baseline getting stuck the comparison would prove nothing
+    assert(stuck["false"] > 0)
+    assert(stuck["true"] < stuck["false"])
+    assert(raycasts["true"] < raycasts["false"])
+    assert(despawns["true"] <= despawns["false"])
+
+def test_bench_steering():
+    # this raises when the batched kernel disagrees with Mob::update
+    output = run_server("--benchsteering", "1000")
+    assert("ns per mob" in output)
+
+def test_bench_sight():
+    # this raises when the grid disagrees with box2d
+    output = run_server("--benchsight", "10000")
+    assert("rays per second" in output)
+    assert("% culled" in output)
+
+def test_bench_visibility_polygon():
+    # the polygon may only save rays, every bot has to be sent exactly what it is sent without it
+    checksums, culled = {}, {}
+    for polygon in ["true", "false"]:
+        output = run_server("--bench", "200", "--seed", "1234", "--visibilitypolygon=" + polygon)
+        counters = re.search(r"world states checksum (\d+), visibility polygons (\d+), visibility culled (\d+)", output)
+        checksums[polygon] = counters.group(1)
+        culled[polygon] = int(counters.group(3))
+    assert(checksums["true"] == checksums["false"])
+    assert(culled["true"] > 0)
+    assert(culled["false"] == 0)
@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+# stand-in for a prometheus scraper: fetches the metrics endpoint of a game server,
+# checks that the exposition format parses and prints the samples
+import re, sys, urllib.request
+
+SAMPLE_RE = re.compile(r'^([a-zA-Z_:][a-zA-Z0-9_:]*)(\{[^}]*\})? (\S+)$')
+
+REQUIRED = [
+    "deadfish_tick_seconds_count",
+    "deadfish_physics_step_seconds_count",
+    "deadfish_presimulation_seconds_count",
+    "deadfish_raycasts_per_tick_count",
+    "deadfish_players",
+    "deadfish_civilians",
+    "deadfish_lock_queue_depth",
+]
+
+def scrape(url):
+    with urllib.request.urlopen(url, timeout=5) as response:
+        text = response.read().decode()
+    samples = {}
+    types = {}
+    for line in text.splitlines():
+        if line.startswith("# TYPE "):
+            _, _, name, kind = line.split(" ")
+            types[name] = kind
+            continue
+        if not line or line.startswith("#"):
+            continue
+        match = SAMPLE_RE.match(line)
+        if not match:
+            raise ValueError("malformed sample line: " + line)
+        name, labels, value = match.groups()
+        samples[name + (labels or "")] = float(value)
+    return types, samples
+
+def main():
+    url = sys.argv[1] if len(sys.argv) > 1 else "http://localhost:9100/metrics"
+    types, samples = scrape(url)
+    missing = [name for name in REQUIRED if name not in samples]
+    for name, value in sorted(samples.items()):
+        print(name, value)
+    if missing:
+        print("missing metrics:", ", ".join(missing))
+        exit(1)
+
+if __name__ == "__main__":
+    main()